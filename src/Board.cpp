@@ -0,0 +1,541 @@
+#include "Board.h"
+#include <libmaple/dma.h>
+#include <libmaple/spi.h>
+
+SdStorage::SdStorage(uint8_t csPin)
+{
+  _csPin = csPin;
+  _extentCount = 0;
+  _lastExtent = 0;
+  _size = 0;
+  _pos = 0;
+  _streamBlock = SD_NO_BLOCK;
+  _bufBlock = SD_NO_BLOCK;
+  _buf = NULL;
+  _readState = SD_READ_IDLE;
+  _readDst = NULL;
+  _readStart = 0;
+  _readResult = 0;
+}
+
+//End the multi-block read and forget the staged block before SdFat uses the bus or its cache
+void SdStorage::ReleaseCard()
+{
+  WaitRead();
+  if(_streamBlock != SD_NO_BLOCK)
+    _sd.card()->readStop();
+  _streamBlock = SD_NO_BLOCK;
+  _bufBlock = SD_NO_BLOCK;
+}
+
+//Walk the track's cluster chain once, recording each run of consecutive clusters.
+//Returns false for an empty track or one with more than SD_MAX_EXTENTS runs
+bool SdStorage::MapExtents()
+{
+  FatVolume *vol = _sd.vol();
+  uint8_t shift = vol->clusterSizeShift();
+  uint32_t cluster = _file.firstCluster();
+  uint32_t fileBlock = 0;
+  _extentCount = 0;
+  _lastExtent = 0;
+  if(cluster < 2)
+    return false;
+  for(;;)
+  {
+    if(_extentCount == SD_MAX_EXTENTS)
+      break;
+    SdExtent *extent = &_extents[_extentCount++];
+    extent->fileBlock = fileBlock;
+    extent->cardBlock = vol->dataStartBlock() + ((cluster - 2) << shift);
+    uint32_t next;
+    int8_t more;
+    while((more = vol->dbgFat(cluster, &next)) > 0 && next == cluster + 1) //dbgFat() is SdFat's public fatGet()
+    {
+      cluster = next;
+      fileBlock += 1 << shift;
+    }
+    fileBlock += 1 << shift;
+    if(more < 0)
+      break;
+    if(more == 0) //End of chain
+      return true;
+    cluster = next;
+  }
+  _extentCount = 0;
+  return false;
+}
+
+//Card block holding a block of the open track
+uint32_t SdStorage::CardBlock(uint32_t fileBlock)
+{
+  uint8_t lo = _lastExtent;
+  uint8_t hi = _extentCount - 1;
+  if(_extents[lo].fileBlock > fileBlock)
+    lo = 0;
+  else if(lo == hi || _extents[lo+1].fileBlock > fileBlock)
+    hi = lo;
+  while(lo < hi)
+  {
+    uint8_t mid = (lo + hi + 1) / 2;
+    if(_extents[mid].fileBlock <= fileBlock)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  _lastExtent = lo;
+  return _extents[lo].cardBlock + fileBlock - _extents[lo].fileBlock;
+}
+
+//Read one block, continuing the open multi-block read if it is already positioned there
+bool SdStorage::StreamBlock(uint32_t block, uint8_t *dst)
+{
+  if(_streamBlock != block)
+  {
+    if(_streamBlock != SD_NO_BLOCK)
+      _sd.card()->readStop();
+    _streamBlock = SD_NO_BLOCK;
+    if(!_sd.card()->readStart(block))
+      return false;
+  }
+  if(!_sd.card()->readData(dst))
+  {
+    _sd.card()->readStop();
+    _streamBlock = SD_NO_BLOCK;
+    return false;
+  }
+  _streamBlock = block + 1;
+  return true;
+}
+
+static uint8_t spiByte(uint8_t out)
+{
+  spi_tx_reg(SPI1, out);
+  while(!spi_is_rx_nonempty(SPI1)){};
+  return spi_rx_reg(SPI1);
+}
+
+//Move the background read on as far as it goes without waiting
+void SdStorage::AdvanceRead()
+{
+  static uint8_t idle = 0xFF; //Clocked out while the block is received
+  if(_readState == SD_READ_TOKEN)
+  {
+    uint8_t token = 0xFF;
+    for(uint8_t i = 0; i<SD_TOKEN_POLLS && token == 0xFF; i++)
+      token = spiByte(0xFF);
+    if(token == 0xFF)
+    {
+      if(millis() - _readStart > SD_READ_TIMEOUT)
+        EndRead(-1);
+      return;
+    }
+    if(token != DATA_START_BLOCK)
+    {
+      EndRead(-1);
+      return;
+    }
+    spi_rx_reg(SPI1); //Drop anything left in the receive register
+    dma_setup_transfer(DMA1, DMA_CH2, &SPI1->regs->DR, DMA_SIZE_8BITS, _readDst, DMA_SIZE_8BITS, DMA_MINC_MODE);
+    dma_set_num_transfers(DMA1, DMA_CH2, 512);
+    dma_setup_transfer(DMA1, DMA_CH3, &SPI1->regs->DR, DMA_SIZE_8BITS, &idle, DMA_SIZE_8BITS, DMA_FROM_MEM);
+    dma_set_num_transfers(DMA1, DMA_CH3, 512);
+    dma_clear_isr_bits(DMA1, DMA_CH2);
+    spi_rx_dma_enable(SPI1);
+    spi_tx_dma_enable(SPI1);
+    dma_enable(DMA1, DMA_CH2);
+    dma_enable(DMA1, DMA_CH3);
+    _readState = SD_READ_DMA;
+  }
+  else if(_readState == SD_READ_DMA)
+  {
+    if(!(dma_get_isr_bits(DMA1, DMA_CH2) & DMA_ISR_TCIF1))
+      return;
+    while(spi_is_busy(SPI1)){};
+    dma_disable(DMA1, DMA_CH3);
+    dma_disable(DMA1, DMA_CH2);
+    dma_clear_isr_bits(DMA1, DMA_CH2);
+    dma_clear_isr_bits(DMA1, DMA_CH3);
+    spi_rx_dma_disable(SPI1);
+    spi_tx_dma_disable(SPI1);
+    spiByte(0xFF); //CRC, not checked, as with SdFat's own reads
+    spiByte(0xFF);
+    _streamBlock++;
+    _pos += 512;
+    EndRead(512);
+  }
+}
+
+//Let a background read run to completion. Its result is kept for PollRead()
+void SdStorage::WaitRead()
+{
+  while(_readState == SD_READ_TOKEN || _readState == SD_READ_DMA)
+    AdvanceRead();
+}
+
+void SdStorage::EndRead(int result)
+{
+  if(result < 0)
+  {
+    _sd.card()->readStop();
+    _streamBlock = SD_NO_BLOCK;
+  }
+  _readResult = result;
+  _readState = SD_READ_DONE;
+}
+
+//Only whole blocks of a mapped track are read in the background, one per call
+bool SdStorage::BeginRead(void *dst, uint32_t count)
+{
+  if(_extentCount == 0 || _readState != SD_READ_IDLE || count < 512 || (_pos & 511) || _size - _pos < 512)
+    return false;
+  uint32_t block = CardBlock(_pos >> 9);
+  if(_streamBlock != block)
+  {
+    if(_streamBlock != SD_NO_BLOCK)
+      _sd.card()->readStop();
+    _streamBlock = SD_NO_BLOCK;
+    if(!_sd.card()->readStart(block))
+      return false;
+    _streamBlock = block;
+  }
+  _readDst = (uint8_t *)dst;
+  _readStart = millis();
+  _readState = SD_READ_TOKEN;
+  return true;
+}
+
+int SdStorage::PollRead()
+{
+  if(_readState == SD_READ_IDLE)
+    return -1;
+  AdvanceRead();
+  if(_readState != SD_READ_DONE)
+    return 0;
+  _readState = SD_READ_IDLE;
+  return _readResult;
+}
+
+bool SdStorage::Begin()
+{
+  dma_init(DMA1);
+  return _sd.begin(_csPin, SD_SCK_HZ(F_CPU/2));
+}
+
+void SdStorage::RemoveMeta()
+{
+  ReleaseCard();
+  File tmpFile;
+  char fileName[128];
+  while ( tmpFile.openNext( _sd.vwd(), O_READ ))
+  {
+    memset(fileName, 0x00, sizeof(fileName));
+    tmpFile.getName(fileName, sizeof(fileName));
+    if(fileName[0]=='.')
+    {
+      if(!_sd.remove(fileName))
+      if(!tmpFile.rmRfStar())
+      {
+        Serial.print("FAILED TO DELETE META FILE"); Serial.println(fileName);
+      }
+    }
+    if(strcmp(fileName, "System Volume Information") == 0)
+    {
+      if(!tmpFile.rmRfStar())
+        Serial.println("FAILED TO REMOVE SVI");
+    }
+    tmpFile.close();
+  }
+  tmpFile.close();
+  _sd.vwd()->rewind();
+}
+
+void SdStorage::Rewind()
+{
+  ReleaseCard();
+  _sd.vwd()->rewind();
+}
+
+bool SdStorage::NextEntry(uint16_t &dirIndex, char *name, size_t size)
+{
+  ReleaseCard();
+  File entry;
+  if(!entry.openNext(_sd.vwd(), O_READ))
+    return false;
+  entry.getName(name, size);
+  dirIndex = entry.dirIndex();
+  entry.close();
+  return true;
+}
+
+bool SdStorage::EntryName(uint16_t dirIndex, char *name, size_t size)
+{
+  ReleaseCard();
+  File entry;
+  if(!entry.open(_sd.vwd(), dirIndex, O_READ))
+    return false;
+  entry.getName(name, size);
+  entry.close();
+  return true;
+}
+
+bool SdStorage::Open(uint16_t dirIndex)
+{
+  ReleaseCard();
+  _readState = SD_READ_IDLE; //An uncollected read belonged to the previous track
+  if(_file.isOpen())
+    _file.close();
+  _extentCount = 0;
+  if(!_file.open(_sd.vwd(), dirIndex, O_READ))
+    return false;
+  _size = _file.fileSize();
+  _pos = 0;
+  MapExtents();
+  return true;
+}
+
+void SdStorage::Name(char *name, size_t size)
+{
+  ReleaseCard();
+  _file.getName(name, size);
+}
+
+int SdStorage::Read(void *dst, uint32_t count)
+{
+  WaitRead();
+  if(_extentCount == 0)
+    return _file.read(dst, count);
+  uint8_t *out = (uint8_t *)dst;
+  if(count > _size - _pos)
+    count = _size - _pos;
+  uint32_t done = 0;
+  while(done < count)
+  {
+    uint32_t block = CardBlock(_pos >> 9);
+    uint32_t offset = _pos & 511;
+    uint32_t n = 512 - offset;
+    if(n > count - done)
+      n = count - done;
+    if(n == 512)
+    {
+      if(!StreamBlock(block, out + done))
+        break;
+    }
+    else
+    {
+      if(block != _bufBlock)
+      {
+        cache_t *cache = _sd.vol()->cacheClear();
+        _bufBlock = SD_NO_BLOCK;
+        if(!cache || !StreamBlock(block, cache->data))
+          break;
+        _buf = cache->data;
+        _bufBlock = block;
+      }
+      memcpy(out + done, _buf + offset, n);
+    }
+    _pos += n;
+    done += n;
+  }
+  return done > 0 || count == 0 ? done : -1;
+}
+
+bool SdStorage::Seek(uint32_t pos)
+{
+  WaitRead();
+  if(_extentCount == 0)
+    return _file.seekSet(pos);
+  if(_streamBlock != SD_NO_BLOCK)
+    _sd.card()->readStop();
+  _streamBlock = SD_NO_BLOCK;
+  if(pos > _size)
+    return false;
+  _pos = pos;
+  return true;
+}
+
+uint32_t SdStorage::Position()
+{
+  return _extentCount ? _pos : _file.curPosition();
+}
+
+uint32_t SdStorage::Available()
+{
+  return _extentCount ? _size - _pos : _file.available();
+}
+
+void OPMBus::Dump(SerialPort &out)
+{
+#if YM_SHADOW_REGS
+  char line[48];
+  snprintf(line, sizeof(line), "Redundant writes skipped: %lu/%lu",
+    (unsigned long)_opm.ElidedWrites(), (unsigned long)_opm.TotalWrites());
+  out.PrintLine(line);
+#endif
+}
+
+void Timer4SampleTimer::Begin(void (*isr)())
+{
+  Timer4.pause();
+  Timer4.setPrescaleFactor(1);
+  Timer4.setOverflow(1633);
+  Timer4.setChannel1Mode(TIMER_OUTPUT_COMPARE);
+  Timer4.attachCompare1Interrupt(isr);
+  Timer4.refresh();
+  Timer4.resume();
+}
+
+void Buttons::Begin()
+{
+  for(uint8_t i = 0; i<BUTTON_COUNT; i++)
+  {
+    pinMode(_pins[i], INPUT_PULLUP);
+    _idr[i] = &PIN_MAP[_pins[i]].gpio_device->regs->IDR;
+    _bit[i] = 1 << PIN_MAP[_pins[i]].gpio_bit;
+    _count[i] = 0;
+  }
+  _down = 0;
+  _ticks = 0;
+  _events.clear();
+}
+
+void Buttons::Tick()
+{
+  if(++_ticks < BUTTON_SAMPLE_TICKS)
+    return;
+  _ticks = 0;
+  for(uint8_t i = 0; i<BUTTON_COUNT; i++)
+  {
+    uint8_t bit = 1 << i;
+    if(!(*_idr[i] & _bit[i]))
+    {
+      if(_count[i] < BUTTON_DEBOUNCE)
+        _count[i]++;
+    }
+    else if(_count[i] > 0)
+      _count[i]--;
+
+    if(!(_down & bit))
+    {
+      if(_count[i] == BUTTON_DEBOUNCE)
+      {
+        _down |= bit;
+        _held[i] = BUTTON_REPEAT_DELAY;
+        _events.push_back(i);
+      }
+    }
+    else if(_count[i] == 0)
+      _down &= ~bit;
+    else if((_repeatMask & bit) && --_held[i] == 0)
+    {
+      _held[i] = BUTTON_REPEAT_RATE;
+      _events.push_back(i);
+    }
+  }
+}
+
+void OLEDDisplay::Begin()
+{
+  _u8g2.begin();
+  _tiles.Reset();
+  _tickerCount = 0;
+}
+
+void OLEDDisplay::EndFrame()
+{
+  _tiles.Redrawn(_u8g2.getBufferPtr(), 0, OLED_TILE_ROWS-1);
+}
+
+//Send the next run of dirty tiles. False if there were none
+bool OLEDDisplay::SendSlice()
+{
+  uint8_t tx, ty, tw;
+  if(!_tiles.NextSlice(tx, ty, tw))
+    return false;
+  _u8g2.updateDisplayArea(tx, ty, tw, 1);
+  return true;
+}
+
+bool OLEDDisplay::Update()
+{
+  if(SendSlice())
+    return true;
+  if(_tickerCount == 0 || (int32_t)(millis() - _scrollAt) < 0)
+    return false;
+  bool wrapped = false;
+  for(uint8_t i = 0; i < _tickerCount; i++)
+  {
+    Scroll(_tickers[i]);
+    wrapped |= _tickers[i].offset == 0;
+  }
+  _scrollAt = millis() + (wrapped ? OLED_SCROLL_HOLD_MS : OLED_SCROLL_MS);
+  return SendSlice();
+}
+
+//Scroll text in the current font if it is too wide for the panel. The line owns pixel rows top to bottom
+void OLEDDisplay::AddTicker(const char *text, uint8_t baseline, uint8_t top, uint8_t bottom)
+{
+  uint16_t width = _u8g2.getUTF8Width(text);
+  if(width <= OLED_WIDTH)
+    return;
+  OLEDTicker &ticker = _tickers[_tickerCount++];
+  ticker.text = text;
+  ticker.font = _u8g2.getU8g2()->font;
+  ticker.width = width;
+  ticker.offset = 0;
+  ticker.baseline = baseline;
+  ticker.top = top;
+  ticker.bottom = bottom;
+}
+
+//Advance a ticker one step. Its rows are cleared and the title drawn into them, clipped, where it starts
+//and where it comes round again after the gap
+void OLEDDisplay::Scroll(OLEDTicker &ticker)
+{
+  uint16_t period = ticker.width + OLED_TICKER_GAP;
+  ticker.offset += OLED_SCROLL_STEP;
+  if(ticker.offset >= period)
+    ticker.offset = 0;
+  _u8g2.setDrawColor(0);
+  _u8g2.drawBox(0, ticker.top, OLED_WIDTH, ticker.bottom - ticker.top + 1);
+  _u8g2.setDrawColor(1);
+  _u8g2.setClipWindow(0, ticker.top, OLED_WIDTH, ticker.bottom + 1);
+  _u8g2.setFont(ticker.font);
+  _u8g2.drawUTF8(-(int16_t)ticker.offset, ticker.baseline, ticker.text);
+  if(period - ticker.offset < OLED_WIDTH)
+    _u8g2.drawUTF8(period - ticker.offset, ticker.baseline, ticker.text);
+  _u8g2.setMaxClipWindow();
+  _tiles.Redrawn(_u8g2.getBufferPtr(), ticker.top/8, ticker.bottom/8);
+}
+
+void OLEDDisplay::ShowMessage(const char *top, const char *bottom)
+{
+  _tickerCount = 0;
+  _u8g2.clearBuffer();
+  _u8g2.setFont(u8g2_font_fub11_tf);
+  _u8g2.drawStr(0,16, top);
+  _u8g2.drawStr(0,32, bottom);
+  EndFrame();
+  while(SendSlice()){}
+}
+
+void OLEDDisplay::ShowTrack(const char *track, const char *game, PlayMode mode)
+{
+  _u8g2.clearBuffer();
+  _u8g2.setFont(u8g2_font_helvR08_tf);
+  _tickerCount = 0;
+  AddTicker(track, 9, 0, 12);
+  AddTicker(game, 22, 13, 26); //Mode text starts on row 27
+  _scrollAt = millis() + OLED_SCROLL_HOLD_MS;
+
+  _u8g2.drawUTF8(0,9, track);
+  _u8g2.drawUTF8(0,22, game);
+
+  _u8g2.setFont(u8g2_font_micro_tr);
+  if(mode == LOOP)
+    _u8g2.drawStr(0,32, "LOOP");
+  else if(mode == SHUFFLE)
+    _u8g2.drawStr(0,32, "SHUFFLE");
+  else
+    _u8g2.drawStr(0,32, "IN ORDER");
+  EndFrame();
+}
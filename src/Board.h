@@ -0,0 +1,190 @@
+#ifndef BOARD_H_
+#define BOARD_H_
+#include <Arduino.h>
+#include <U8g2lib.h>
+#include "SdFat.h"
+#include "Hal.h"
+#include "YM2151.h"
+#include "LTC6903.h"
+#include "ringbuffer.h"
+#include "OLEDTiles.h"
+//STM32 "Blue Pill" implementations of the Hal.h interfaces
+
+#define SD_NO_BLOCK 0xFFFFFFFF
+#define SD_MAX_EXTENTS 16 //Fragments a track may have and still be read without the FAT layer
+#define SD_TOKEN_POLLS 16 //Bytes clocked per PollRead() while waiting for the card's data start token
+
+//Background block read
+#define SD_READ_IDLE 0
+#define SD_READ_TOKEN 1 //Waiting for the card to send the data start token
+#define SD_READ_DMA 2 //Block moving into the caller's buffer by DMA
+#define SD_READ_DONE 3 //Result waiting to be collected by PollRead()
+//Run of consecutive blocks of the open track
+struct SdExtent
+{
+    uint32_t fileBlock; //First file block of the run. The run ends where the next one begins
+    uint32_t cardBlock; //Card block it is stored in
+};
+
+//When a track is opened its cluster chain is walked once into a list of extents. From then on reads and
+//seeks go straight to the card without touching the FAT, any position is found by a binary search over
+//the extents. Whole blocks stream into the caller's buffer through a multi-block read (CMD18) that stays
+//open from one Read() to the next and only restarts where a fragment ends. Partial blocks are staged in
+//SdFat's block cache. Any other call ends the stream first. The LTC6903 sits on the same SPI bus, so the
+//player calls Release() to end the stream and raise CS before it programs a new clock.
+//BeginRead() reads the next block of the stream in the background. PollRead() clocks a few bytes while
+//the card is still looking for the block, then hands the 512 data bytes to the SPI1 DMA channels and
+//returns straight away until they have arrived. SdFat's own reads block on the same channels, so
+//every other call lets a background read finish first.
+//Tracks with more than SD_MAX_EXTENTS fragments go through File as before
+class SdStorage : public TrackStorage
+{
+private:
+    SdFat _sd;
+    File _file;
+    uint8_t _csPin;
+    SdExtent _extents[SD_MAX_EXTENTS];
+    uint8_t _extentCount; //0 when the open track is read through _file
+    uint8_t _lastExtent; //Extent of the previous lookup, checked first since reads are mostly sequential
+    uint32_t _size;
+    uint32_t _pos; //Read position of a mapped track. _file's own position is not kept up to date
+    uint32_t _streamBlock; //Block the open multi-block read delivers next
+    uint32_t _bufBlock; //Block staged in the SdFat cache
+    uint8_t *_buf;
+    uint8_t _readState;
+    uint8_t *_readDst;
+    uint32_t _readStart; //millis() the token wait began
+    int _readResult;
+    void ReleaseCard();
+    void AdvanceRead();
+    void WaitRead();
+    void EndRead(int result);
+    bool MapExtents();
+    uint32_t CardBlock(uint32_t fileBlock);
+    bool StreamBlock(uint32_t block, uint8_t *dst);
+public:
+    SdStorage(uint8_t csPin);
+    bool Begin(); //Mount the card. Returns false if it could not be mounted
+    void RemoveMeta(); //Remove useless meta files
+    void Rewind();
+    bool NextEntry(uint16_t &dirIndex, char *name, size_t size);
+    bool EntryName(uint16_t dirIndex, char *name, size_t size);
+    bool Open(uint16_t dirIndex);
+    void Name(char *name, size_t size);
+    int Read(void *dst, uint32_t count);
+    bool Seek(uint32_t pos);
+    uint32_t Position();
+    uint32_t Available();
+    bool BeginRead(void *dst, uint32_t count);
+    int PollRead();
+    void Release() {ReleaseCard();}
+};
+
+class OPMBus : public ChipBus
+{
+private:
+    YM2151 &_opm;
+    LTC6903 &_clock;
+public:
+    OPMBus(YM2151 &opm, LTC6903 &clock) : _opm(opm), _clock(clock) {}
+    void Reset() {_opm.Reset();}
+    void SetClock(uint32_t hz) {_opm.SetClock(hz + _clock.SetFrequency(hz));} //The chip's busy period follows the clock actually programmed
+    void Write(uint8_t addr, uint8_t data) {_opm.SendDataPins(addr, data);}
+    bool Busy() {return _opm.Busy();}
+    void Dump(SerialPort &out);
+};
+
+//Timer4 compare interrupt at 72MHz/1633 = 44.09KHz
+class Timer4SampleTimer : public SampleTimer
+{
+public:
+    void Begin(void (*isr)());
+};
+
+//Buttons
+#define BUTTON_COUNT 5
+#define BUTTON_SAMPLE_TICKS 44 //Sample timer ticks between button reads, about 1mS
+#define BUTTON_DEBOUNCE 20 //Reads in a row a button must agree on before a press or release counts
+#define BUTTON_REPEAT_DELAY 500 //Reads a repeating button is held before it repeats
+#define BUTTON_REPEAT_RATE 250 //Reads between repeats
+#define BUTTON_QUEUE_SIZE 8
+
+//Active low buttons on pull-ups, read straight from their port registers by Tick() in the sample timer
+//interrupt. Each has an integrating debouncer that counts up while it reads pressed and down while it
+//doesn't, so contact bounce only changes its state once the count reaches an end. Presses go into a
+//queue the main loop drains with Read(), which never waits. Buttons in the repeat mask queue another
+//press while they are held, for stepping through tracks
+class Buttons
+{
+private:
+    const uint8_t *_pins;
+    uint8_t _repeatMask;
+    volatile uint32_t *_idr[BUTTON_COUNT];
+    uint16_t _bit[BUTTON_COUNT];
+    uint8_t _count[BUTTON_COUNT]; //Integrator, 0 released to BUTTON_DEBOUNCE pressed
+    uint16_t _held[BUTTON_COUNT]; //Reads until the next repeat
+    uint8_t _down; //Bit per button currently pressed
+    uint8_t _ticks;
+    ringbuffer_t<uint8_t, BUTTON_QUEUE_SIZE, int16_t> _events;
+public:
+    Buttons(const uint8_t *pins, uint8_t repeatMask) : _pins(pins), _repeatMask(repeatMask) {}
+    void Begin();
+    void Tick(); //Call from the sample timer interrupt
+    int Read() {return _events.pop_front();} //Index into pins of the next press, -1 if there is none
+};
+
+//Title ticker
+#define OLED_TICKER_GAP 32 //Blank columns between the end of a title and its start coming round again
+#define OLED_SCROLL_STEP 2 //Pixels per scroll step
+#define OLED_SCROLL_MS 60 //Time between steps
+#define OLED_SCROLL_HOLD_MS 1500 //Pause with the start of the title showing
+
+//Line of the track screen too wide for the panel. Each scroll step draws it again from the font, clipped
+//to its own pixel rows, so nothing is pre-rendered
+struct OLEDTicker
+{
+    const char *text; //ShowTrack()'s argument, see Display in Hal.h
+    const uint8_t *font;
+    uint16_t width; //Rendered width in pixels
+    uint16_t offset; //Title column shown at the left edge
+    uint8_t baseline;
+    uint8_t top; //First pixel row of the line
+    uint8_t bottom; //Last pixel row of the line
+};
+
+//128x32 SSD1306 on hardware I2C.
+//ShowTrack() only draws into the u8g2 frame buffer and marks the tiles that may have changed (see
+//OLEDTiles.h). Update() then sends them a run of up to OLED_SLICE_TILES at a time, so a redraw never holds
+//the main loop for a whole blocking frame transfer.
+//Titles wider than the panel scroll. Once the panel has caught up, Update() redraws each ticker's line
+//in the frame buffer and marks its tiles, which then go out in slices
+class OLEDDisplay : public Display
+{
+private:
+    U8G2_SSD1306_128X32_UNIVISION_F_HW_I2C _u8g2;
+    OLEDTiles _tiles;
+    OLEDTicker _tickers[2];
+    uint8_t _tickerCount;
+    uint32_t _scrollAt; //millis() of the next scroll step
+    void EndFrame();
+    bool SendSlice();
+    void AddTicker(const char *text, uint8_t baseline, uint8_t top, uint8_t bottom);
+    void Scroll(OLEDTicker &ticker);
+public:
+    OLEDDisplay() : _u8g2(U8G2_R0) {}
+    void Begin();
+    void ShowMessage(const char *top, const char *bottom);
+    void ShowTrack(const char *track, const char *game, PlayMode mode);
+    bool Update();
+};
+
+class ArduinoSerial : public SerialPort
+{
+public:
+    int Available() {return Serial.available();}
+    int Read() {return Serial.read();}
+    void Print(const char *text) {Serial.print(text);}
+    void PrintLine(const char *line) {Serial.println(line);}
+    void Write(const uint8_t *data, size_t size) {Serial.write(data, size);}
+};
+#endif
@@ -0,0 +1,29 @@
+#ifndef CYCLECOUNTER_H_
+#define CYCLECOUNTER_H_
+#include <stdint.h>
+//Free running timestamp for measuring short intervals. The Cortex-M3 DWT cycle counter on target,
+//CLOCK_MONOTONIC nanoseconds on a host build. Differences are wrap safe as uint32_t.
+#ifdef ARDUINO
+#include <Arduino.h>
+#define CYCLE_TICKS_PER_US (F_CPU / 1000000)
+inline void cycleCounterBegin()
+{
+  *(volatile uint32_t *)0xE000EDFC |= 1 << 24; //DEMCR.TRCENA
+  *(volatile uint32_t *)0xE0001000 |= 1; //DWT_CTRL.CYCCNTENA
+}
+inline uint32_t cycleCount()
+{
+  return *(volatile uint32_t *)0xE0001004; //DWT_CYCCNT
+}
+#else
+#include <time.h>
+#define CYCLE_TICKS_PER_US 1000
+inline void cycleCounterBegin() {}
+inline uint32_t cycleCount()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+#endif
+#endif
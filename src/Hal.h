@@ -0,0 +1,73 @@
+#ifndef HAL_H_
+#define HAL_H_
+#include <stdint.h>
+#include <stddef.h>
+#include "TrackStructs.h"
+//Board interfaces the player core is written against. The STM32 implementations are in Board.h,
+//the host stand-ins used by env:native are in native/HostBoard.h
+
+//Line oriented console. Print/PrintLine take plain C strings so the core never needs Arduino's Print class
+class SerialPort
+{
+public:
+    virtual int Available() = 0;
+    virtual int Read() = 0; //Next byte, or -1 if none is pending
+    virtual void Print(const char *text) = 0;
+    virtual void PrintLine(const char *line) = 0;
+    virtual void Write(const uint8_t *data, size_t size) = 0; //Raw bytes, for serial streaming frames
+};
+
+//Root directory of the card plus the one open track. Entries are addressed by their directory index,
+//which stays valid for as long as the card is mounted
+class TrackStorage
+{
+public:
+    virtual void Rewind() = 0; //Restart NextEntry() at the first entry
+    virtual bool NextEntry(uint16_t &dirIndex, char *name, size_t size) = 0;
+    virtual bool EntryName(uint16_t dirIndex, char *name, size_t size) = 0;
+    virtual bool Open(uint16_t dirIndex) = 0; //Closes the previous track first
+    virtual void Name(char *name, size_t size) = 0; //Name of the open track
+    virtual int Read(void *dst, uint32_t count) = 0; //Bytes read, <= 0 at end of file or on error
+    virtual bool Seek(uint32_t pos) = 0;
+    virtual uint32_t Position() = 0;
+    virtual uint32_t Available() = 0; //Bytes left between Position() and end of file
+    //Background reads. BeginRead() starts reading up to count bytes into dst and returns false if the storage
+    //can't, use Read() then. PollRead() returns 0 while the read is running, then what Read() would have
+    //returned. Leave dst alone until then. Position() moves once the read completes, any call that reads
+    //or repositions the file finishes it first
+    virtual bool BeginRead(void *dst, uint32_t count) {return false;}
+    virtual int PollRead() {return -1;}
+    virtual void Release() {} //Finish any transfer and free the bus for other devices on it. Reads carry on from Position()
+};
+
+//The YM2151 and its clock generator. Write() and Busy() are called from the sample timer ISR
+class ChipBus
+{
+public:
+    virtual void Reset() = 0;
+    virtual void SetClock(uint32_t hz) = 0;
+    virtual void Write(uint8_t addr, uint8_t data) = 0;
+    virtual bool Busy() = 0; //True while a write now would be dropped by the chip
+    virtual void Dump(SerialPort &out) {} //Bus specific counters for the '?' command
+};
+
+//Calls the player's tick at 44.1KHz
+class SampleTimer
+{
+public:
+    virtual void Begin(void (*isr)()) = 0;
+};
+
+//ShowMessage() is shown before it returns. ShowTrack() may only draw into memory and leave the transfer
+//to Update(), which the player calls between parses while it is well ahead of the sample clock.
+//The strings passed to ShowTrack() must stay unchanged until the next ShowTrack() or ShowMessage(),
+//a scrolling title is drawn from them again on every step
+class Display
+{
+public:
+    virtual void Begin() = 0;
+    virtual void ShowMessage(const char *top, const char *bottom) = 0;
+    virtual void ShowTrack(const char *track, const char *game, PlayMode mode) = 0;
+    virtual bool Update() {return false;} //Send a short slice of the pending frame. False once the screen is up to date
+};
+#endif
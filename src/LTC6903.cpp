@@ -1,14 +1,28 @@
 #include "LTC6903.h"
+#ifdef ARDUINO //The host build only uses the solver
 #include <SPI.h>
+#endif
 LTC6903::LTC6903(int target)
 {
   _target = target;
+  _oct = LTC6903_UNSET;
+  _dac = LTC6903_UNSET;
+  _begun = false;
 }
 
 void LTC6903::SetManual(uint16_t oct, uint16_t dac)
 {
-  pinMode(_target, OUTPUT);
-  SPI.begin();
+  if(oct == _oct && dac == _dac)
+    return;
+  _oct = oct;
+  _dac = dac;
+  #ifdef ARDUINO
+  if(!_begun)
+  {
+    pinMode(_target, OUTPUT);
+    SPI.begin();
+    _begun = true;
+  }
   //SPI.beginTransaction(SPISettings(20000000, MSBFIRST, SPI_MODE0));
   unsigned char CNF = 0b00000000;
   uint16_t BitMap = (oct << 12) | (dac << 2) | CNF;
@@ -19,11 +33,47 @@ void LTC6903::SetManual(uint16_t oct, uint16_t dac)
   SPI.transfer(Byte2);
   digitalWrite(_target, HIGH);
   SPI.endTransaction();
+  #endif
 }
 
-void LTC6903::SetFrequency(uint32_t freq)
+void LTC6903::Solve(uint32_t freq, uint16_t &oct, uint16_t &dac)
 {
-  _oct = 3.322 * log10(freq/1039);
-  _dac = round(2048 - ((2078 * pow(2, 10+_oct)) / freq));
-  SetManual(_oct, _dac);
+  //Octave whose range [1039 << oct, 2078 << oct) holds freq
+  oct = 0;
+  while(oct < LTC6903_MAX_OCT && freq >= ((uint32_t)LTC6903_MIN_HZ << (oct+1)))
+    oct++;
+  if(freq < LTC6903_MIN_HZ)
+  {
+    dac = 0;
+    return;
+  }
+  //DAC = 2048 - 2078 * 2^(10+OCT) / f, rounded to nearest
+  uint64_t span = (uint64_t)2078 << (10+oct);
+  uint32_t divisor = (span + freq/2) / freq;
+  dac = 2048 - divisor;
+  if(dac > LTC6903_MAX_DAC) //Rounded up to the next octave's first step
+  {
+    if(oct < LTC6903_MAX_OCT)
+    {
+      oct++;
+      dac = 0;
+    }
+    else
+      dac = LTC6903_MAX_DAC;
+  }
+}
+
+uint32_t LTC6903::Frequency(uint16_t oct, uint16_t dac)
+{
+  uint64_t span = (uint64_t)2078 << (10+oct);
+  uint32_t divisor = 2048 - dac;
+  return (span + divisor/2) / divisor;
+}
+
+int32_t LTC6903::SetFrequency(uint32_t freq)
+{
+  uint16_t oct, dac;
+  Solve(freq, oct, dac);
+  SetManual(oct, dac);
+  return (int32_t)(Frequency(oct, dac) - freq);
 }
@@ -1,15 +1,26 @@
 #ifndef LTC6903_H_
 #define LTC6903_H_
 #include <stdint.h>
+
+#define LTC6903_MIN_HZ 1039 //Output at OCT 0, DAC 0
+#define LTC6903_MAX_OCT 15
+#define LTC6903_MAX_DAC 1023
+#define LTC6903_UNSET 0xFFFF //No word sent yet
+
+//f = 2^OCT * 2078Hz / (2 - DAC/1024). Settings are solved in integer math and only sent when they change,
+//so tracks sharing a clock don't touch the SPI bus
 class LTC6903
 {
 private:
   uint16_t _oct;
   uint16_t _dac;
   unsigned char _target;
+  bool _begun;
 public:
   LTC6903(int target);
   void SetManual(uint16_t oct, uint16_t dac);
-  void SetFrequency(uint32_t freq);
+  int32_t SetFrequency(uint32_t freq); //Returns the programmed output minus freq, in Hz
+  static void Solve(uint32_t freq, uint16_t &oct, uint16_t &dac); //Closest setting to freq, clamped to the chip's range
+  static uint32_t Frequency(uint16_t oct, uint16_t dac); //Output in Hz, rounded
 };
 #endif
@@ -0,0 +1,43 @@
+#include "OLEDTiles.h"
+
+void OLEDTiles::Reset()
+{
+  for(uint8_t ty = 0; ty < OLED_TILE_ROWS; ty++)
+  {
+    _dirty[ty] = 0;
+    _lit[ty] = 0;
+  }
+}
+
+//Tiles still waiting from an earlier frame stay marked
+void OLEDTiles::Redrawn(const uint8_t *frame, uint8_t firstRow, uint8_t lastRow)
+{
+  for(uint8_t ty = firstRow; ty <= lastRow && ty < OLED_TILE_ROWS; ty++)
+  {
+    uint16_t lit = 0;
+    for(uint8_t tx = 0; tx < OLED_TILE_COLS; tx++)
+    {
+      const uint8_t *tile = frame + ty*OLED_WIDTH + tx*8;
+      if(tile[0] | tile[1] | tile[2] | tile[3] | tile[4] | tile[5] | tile[6] | tile[7])
+        lit |= 1 << tx;
+    }
+    _dirty[ty] |= lit | _lit[ty];
+    _lit[ty] = lit;
+  }
+}
+
+bool OLEDTiles::NextSlice(uint8_t &tx, uint8_t &ty, uint8_t &tw)
+{
+  for(ty = 0; ty < OLED_TILE_ROWS; ty++)
+  {
+    if(!_dirty[ty])
+      continue;
+    tx = __builtin_ctz(_dirty[ty]);
+    tw = 1;
+    while(tw < OLED_SLICE_TILES && tx+tw < OLED_TILE_COLS && (_dirty[ty] >> (tx+tw) & 1))
+      tw++;
+    _dirty[ty] &= ~(((1 << tw)-1) << tx);
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,28 @@
+#ifndef OLEDTILES_H_
+#define OLEDTILES_H_
+#include <stdint.h>
+
+//SSD1306 frame, in 8x8 pixel tiles of 8 bytes. Byte x of tile row ty is frame[ty*OLED_WIDTH + x]
+#define OLED_TILE_COLS 16
+#define OLED_TILE_ROWS 4
+#define OLED_WIDTH 128
+#define OLED_SLICE_TILES 4 //Tiles sent per slice, about 1mS of 400KHz I2C
+
+//Tiles of the frame buffer the panel hasn't been sent yet. Rather than a copy of the last frame it keeps a
+//bit per tile that has any pixel lit. A redrawn tile that is blank before and after can't have changed and
+//is skipped. Every other redrawn tile is sent again, changed or not, so a redraw costs the lit tiles of its
+//rows: a ticker step resends its line, and ShowTrack(), which redraws the whole frame for a mode toggle,
+//resends every tile with text in it. That keeps the panel exact for 8 bytes of RAM instead of a 512 byte copy.
+//Has no hardware dependencies so the native tests can check it against a simulated panel
+class OLEDTiles
+{
+private:
+    uint16_t _dirty[OLED_TILE_ROWS]; //Bit per tile not yet sent
+    uint16_t _lit[OLED_TILE_ROWS]; //Bit per tile with a lit pixel in the frame buffer
+public:
+    OLEDTiles() {Reset();}
+    void Reset(); //Blank frame buffer and panel
+    void Redrawn(const uint8_t *frame, uint8_t firstRow, uint8_t lastRow); //Tile rows firstRow-lastRow were drawn again
+    bool NextSlice(uint8_t &tx, uint8_t &ty, uint8_t &tw); //Takes the next run of up to OLED_SLICE_TILES off the dirty set
+};
+#endif
@@ -0,0 +1,26 @@
+#ifndef OPMSTREAM_H_
+#define OPMSTREAM_H_
+//Compact YM2151-only playback stream, compiled offline from a .vgm by tools/vgm2opm.
+//Foreign chip commands and PCM data blocks are stripped and waits are merged, so the player
+//only ever sees register writes, waits and the end marker.
+//
+//Header (little-endian, all offsets absolute):
+//0x00 "Opm " ident      0x04 File size        0x08 Version          0x0C YM2151 clock
+//0x10 Total samples     0x14 Loop offset      0x18 Loop # samples   0x1C Data offset
+//0x20 GD3 offset (0 if none), remaining bytes up to OPM_HEADER_SIZE are reserved
+//
+//Commands:
+//rr vv      Write vv to register rr, for rr >= OPM_MIN_DIRECT_REG
+//00         End of stream, continue from the loop offset
+//02 nn      Wait nn+1 samples
+//03 nn nn   Wait nnnn samples
+//04 rr vv   Write vv to register rr, for registers below OPM_MIN_DIRECT_REG
+#define OPM_IDENT 0x206D704F
+#define OPM_VERSION 0x100
+#define OPM_HEADER_SIZE 0x40
+#define OPM_MIN_DIRECT_REG 0x08
+#define OPM_END 0x00
+#define OPM_WAIT8 0x02
+#define OPM_WAIT16 0x03
+#define OPM_WRITE_LOW 0x04
+#endif
@@ -0,0 +1,105 @@
+#include "PlaybackStats.h"
+#include "CycleCounter.h"
+#include "Hal.h"
+#include <stdio.h>
+
+PlaybackStats::PlaybackStats()
+{
+    Reset();
+}
+
+void PlaybackStats::Reset()
+{
+    _writes = 0;
+    _worstLateness = 0;
+    for(int i = 0; i<LATENESS_BUCKETS; i++)
+        _lateness[i] = 0;
+    _queueUnderruns = 0;
+    _bufferUnderruns = 0;
+    _lowWater = 0xFFFFFFFF;
+    _refills = 0;
+    _refillBytes = 0;
+    _refillTicks = 0;
+    _worstRefill = 0;
+    _skips = 0;
+    _skipBytes = 0;
+    _worstSkip = 0;
+    _commands = 0;
+    _parses = 0;
+    _parseTicks = 0;
+    _worstParse = 0;
+}
+
+void PlaybackStats::RecordLateness(uint32_t samplesLate)
+{
+    _writes++;
+    if(samplesLate > _worstLateness)
+        _worstLateness = samplesLate;
+    uint8_t bucket = 0;
+    while(samplesLate > 0 && bucket < LATENESS_BUCKETS-1)
+    {
+        samplesLate >>= 1;
+        bucket++;
+    }
+    _lateness[bucket]++;
+}
+
+void PlaybackStats::RecordRefill(uint32_t ticks, uint32_t bytes)
+{
+    _refills++;
+    _refillBytes += bytes;
+    _refillTicks += ticks;
+    if(ticks > _worstRefill)
+        _worstRefill = ticks;
+}
+
+void PlaybackStats::RecordSkip(uint32_t ticks, uint32_t bytes)
+{
+    _skips++;
+    _skipBytes += bytes;
+    if(ticks > _worstSkip)
+        _worstSkip = ticks;
+}
+
+void PlaybackStats::RecordParse(uint32_t ticks)
+{
+    _parses++;
+    _parseTicks += ticks;
+    if(ticks > _worstParse)
+        _worstParse = ticks;
+}
+
+void PlaybackStats::Dump(SerialPort &out)
+{
+    char line[40];
+    #define EMIT(name, value) {snprintf(line, sizeof(line), "%s,%lu", name, (unsigned long)(value)); out.PrintLine(line);}
+    out.PrintLine("metric,value");
+    EMIT("writes", _writes);
+    EMIT("worst_late_samples", _worstLateness);
+    for(int i = 0; i<LATENESS_BUCKETS; i++)
+    {
+        char name[20];
+        if(i < 2)
+            snprintf(name, sizeof(name), "late_%d", i);
+        else if(i == LATENESS_BUCKETS-1)
+            snprintf(name, sizeof(name), "late_%u+", 1u << (i-1));
+        else
+            snprintf(name, sizeof(name), "late_%u-%u", 1u << (i-1), (1u << i) - 1);
+        EMIT(name, _lateness[i]);
+    }
+    EMIT("queue_underruns", _queueUnderruns);
+    EMIT("buffer_underruns", _bufferUnderruns);
+    EMIT("buffer_low_water", _lowWater == 0xFFFFFFFF ? 0 : _lowWater);
+    EMIT("refills", _refills);
+    EMIT("refill_bytes", _refillBytes);
+    EMIT("refill_avg_us", _refills ? _refillTicks / _refills / CYCLE_TICKS_PER_US : 0);
+    EMIT("refill_worst_us", _worstRefill / CYCLE_TICKS_PER_US);
+    EMIT("skips", _skips);
+    EMIT("skip_bytes", _skipBytes);
+    EMIT("skip_worst_us", _worstSkip / CYCLE_TICKS_PER_US);
+    EMIT("commands", _commands);
+    EMIT("parses", _parses);
+    EMIT("parse_avg_us", _parses ? _parseTicks / _parses / CYCLE_TICKS_PER_US : 0);
+    EMIT("parse_worst_us", _worstParse / CYCLE_TICKS_PER_US);
+    #undef EMIT
+}
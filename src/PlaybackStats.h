@@ -0,0 +1,48 @@
+#ifndef PLAYBACKSTATS_H_
+#define PLAYBACKSTATS_H_
+#include <stdint.h>
+class SerialPort;
+#define LATENESS_BUCKETS 8 //0, 1, 2-3, 4-7 ... samples late. The last bucket catches everything beyond
+//Per track timing instrumentation. Record* calls are cheap enough for the tick ISR.
+//Durations are in CycleCounter ticks and reported in microseconds.
+class PlaybackStats
+{
+private:
+    uint32_t _writes;
+    uint32_t _worstLateness; //Samples
+    uint32_t _lateness[LATENESS_BUCKETS];
+    uint32_t _queueUnderruns; //Sample clock held because nothing was scheduled
+    uint32_t _bufferUnderruns; //Parser found the command buffer empty
+    uint32_t _lowWater; //Fewest bytes seen in the command buffer
+    uint32_t _refills;
+    uint32_t _refillBytes;
+    uint32_t _refillTicks;
+    uint32_t _worstRefill;
+    uint32_t _skips; //Data blocks or commands stepped over by repositioning the file
+    uint32_t _skipBytes;
+    uint32_t _worstSkip;
+    uint32_t _commands; //Stream commands consumed. A parse handles a run of them
+    uint32_t _parses;
+    uint32_t _parseTicks;
+    uint32_t _worstParse;
+public:
+    PlaybackStats();
+    void Reset();
+    void RecordLateness(uint32_t samplesLate);
+    void RecordQueueUnderrun() {_queueUnderruns++;}
+    void RecordBufferUnderrun() {_bufferUnderruns++;}
+    void RecordBufferLevel(uint32_t level) {if(level < _lowWater) _lowWater = level;}
+    void RecordRefill(uint32_t ticks, uint32_t bytes);
+    void RecordSkip(uint32_t ticks, uint32_t bytes);
+    void RecordCommand() {_commands++;}
+    void RecordParse(uint32_t ticks);
+    uint32_t QueueUnderruns() {return _queueUnderruns;}
+    uint32_t BufferUnderruns() {return _bufferUnderruns;}
+    uint32_t Skips() {return _skips;}
+    uint32_t Commands() {return _commands;}
+    uint32_t Parses() {return _parses;}
+    uint32_t RefillBytes() {return _refillBytes;}
+    uint32_t RefillTicks() {return _refillTicks;}
+    void Dump(SerialPort &out); //One "metric,value" CSV line per metric
+};
+#endif
@@ -0,0 +1,1411 @@
+#include "Player.h"
+#include "OPMStream.h"
+#include "VGMOpcodes.h"
+#include "CycleCounter.h"
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+Player::Player(TrackStorage &storage, ChipBus &bus, SampleTimer &timer, Display &display, SerialPort &serial)
+  : _storage(storage), _bus(bus), _timer(timer), _display(display), _serial(serial)
+{
+  _numberOfFiles = 0;
+  _currentFileNumber = 0;
+  _walkTrack = 0;
+  _walkEntry = 0;
+  _bufferPos = 0;
+  _cmdPos = 0;
+  _sampleClock = 0;
+  _parseTime = 0;
+  _clockHeld = false;
+  _loopCount = 0;
+  _maxLoops = 3;
+  _fetching = false;
+  _reading = false;
+  _readStart = 0;
+  _ready = false;
+  _compactStream = false;
+  _streaming = false;
+  _streamClosing = false;
+  _credit = 0;
+  _frameGot = 0;
+  _streamLast = 0;
+  _lineLength = 0;
+  _lineLast = 0;
+  _attenuation = 0;
+  _levelDirty = 0;
+  _seeking = false;
+  _seekTarget = 0;
+  _seekReplay = SEEK_PARSING;
+  _playMode = SHUFFLE;
+  _commandFailed = false;
+  _failedCmd = 0x00;
+  _rng = 1;
+  _cmdBuffer.clear();
+  _eventQueue.clear();
+}
+
+void Player::Begin(void (*isr)())
+{
+  //Prepare files
+  uint16_t dirIndex;
+  memset(_nameBucket, 0xFF, sizeof(_nameBucket));
+  _storage.Rewind();
+  while(_storage.NextEntry(dirIndex, _fileName, MAX_FILE_NAME_SIZE))
+  {
+    if(_numberOfFiles < MAX_INDEXED_FILES)
+    {
+      IndexName(_numberOfFiles, _fileName);
+      _fileIndex[_numberOfFiles] = dirIndex;
+    }
+    _numberOfFiles++;
+  }
+  _storage.Rewind();
+  if(_numberOfFiles > MAX_INDEXED_FILES)
+    Printf("%lu files, the first %d indexed", (unsigned long)_numberOfFiles, MAX_INDEXED_FILES);
+
+  //44.1KHz tick
+  _timer.Begin(isr);
+  if(_numberOfFiles == 0)
+  {
+    _display.ShowMessage("No tracks", "Serial only");
+    return;
+  }
+
+  //Begin
+  StartTrack(FIRST_START);
+  VgmVerify();
+  PrepareChips();
+}
+
+void Player::PrepareChips()
+{
+  _bus.Reset();
+  memset(_connect, 0, sizeof(_connect));
+  memset(_level, 0, sizeof(_level));
+  _levelDirty = 0;
+}
+
+void Player::DrawTrackInfo()
+{
+  _display.ShowTrack(_gd3.Text(GD3_TRACK), _gd3.Text(GD3_GAME), _playMode);
+}
+
+void Player::SetPlayMode(PlayMode mode)
+{
+  _playMode = mode;
+  DrawTrackInfo();
+}
+
+bool Player::ChangeTrack(FileStrategy fileStrategy, const char *request)
+{
+  if(!StartTrack(fileStrategy, request))
+    return false;
+  VgmVerify();
+  PrepareChips();
+  return true;
+}
+
+//Mount file and prepare for playback. Returns true if file is found.
+bool Player::StartTrack(FileStrategy fileStrategy, const char *request)
+{
+  if(_numberOfFiles == 0)
+    return false;
+  //The track is picked before anything is stopped, so a request that finds nothing leaves a seek or the
+  //playing track as it was
+  uint32_t track = _currentFileNumber;
+  switch(fileStrategy)
+  {
+    case FIRST_START:
+      track = 0;
+    break;
+    case NEXT:
+      track = _currentFileNumber+1 >= _numberOfFiles ? 0 : _currentFileNumber+1;
+    break;
+    case PREV:
+      track = _currentFileNumber != 0 ? _currentFileNumber-1 : _numberOfFiles-1;
+    break;
+    case RND:
+      if(_numberOfFiles > 1)
+      {
+        while(track == _currentFileNumber)
+          track = Random(_numberOfFiles);
+      }
+    break;
+    case REQUEST:
+      Printf("REQUEST: %s", request);
+      track = FindTrack(request);
+      if(track == _numberOfFiles)
+      {
+        _serial.PrintLine("ERROR: File not found! Continuing with current song.");
+        return false;
+      }
+      _serial.PrintLine("File found!");
+    break;
+  }
+
+  if(_streaming)
+    StopStream(STREAM_ERR_STOPPED);
+  _ready = false;
+  _seeking = false;
+  memset(_fileName, 0x00, MAX_FILE_NAME_SIZE);
+  _currentFileNumber = track;
+
+  _cmdPos = 0;
+  _bufferPos = 0;
+  _eventQueue.clear();
+  _sampleClock = 0;
+  _parseTime = 0;
+  _stats.Reset();
+  _loopCount = 0;
+
+  CollectRead(true);
+  if(!_storage.Open(TrackEntry(_currentFileNumber)))
+    _serial.PrintLine("Failed to read file");
+  _storage.Name(_fileName, MAX_FILE_NAME_SIZE);
+
+  ClearBuffers();
+  _loopCached = 0;
+  _cacheCursor = 0;
+  uint8_t raw[VGM_HEADER_SIZE];
+  int got = _storage.Read(raw, VGM_HEADER_SIZE);
+  _compactStream = DecodeHeader(_header, raw, got > 0 ? got : 0);
+
+  #if DEBUG
+  Printf("Indent: 0x%lX", (unsigned long)_header.indent);
+  Printf("EoF: 0x%lX", (unsigned long)_header.EoF);
+  Printf("Version: 0x%lX", (unsigned long)_header.version);
+  Printf("SN Clock: %lu", (unsigned long)_header.sn76489Clock);
+  Printf("YM2413 Clock: %lu", (unsigned long)_header.ym2413Clock);
+  Printf("GD3 Offset: 0x%lX", (unsigned long)_header.gd3Offset);
+  Printf("Total Samples: %lu", (unsigned long)_header.totalSamples);
+  Printf("Loop Offset: 0x%lX", (unsigned long)_header.loopOffset);
+  Printf("Loop # Samples: %lu", (unsigned long)_header.loopNumSamples);
+  Printf("Rate: %lu", (unsigned long)_header.rate);
+  Printf("SN etc.: 0x%lX", (unsigned long)_header.snX);
+  Printf("YM2612 Clock: %lu", (unsigned long)_header.ym2612Clock);
+  Printf("YM2151 Clock: %lu", (unsigned long)_header.ym2151Clock);
+  Printf("VGM data Offset: 0x%lX", (unsigned long)_header.vgmDataOffset);
+  Printf("SPCM Interface: 0x%lX", (unsigned long)_header.spcmInterface);
+  _serial.PrintLine("...");
+  Printf("YM3812 Clock: 0x%lX", (unsigned long)_header.ym3812clock);
+  Printf("YMF262clock Clock: 0x%lX", (unsigned long)_header.ymf262clock);
+  Printf("SAA1099 Clock: 0x%lX", (unsigned long)_header.saa1099clock);
+  #endif
+
+  CacheLoop();
+  _storage.Seek(_header.vgmDataOffset);
+  FillBuffer();
+  #if DEBUG
+  //Dump the contents of the loop cache
+  char line[32*6];
+  for(uint32_t i = 0; i<_loopCached; i++)
+  {
+    sprintf(line + (i % 32)*6, "0x%02X, ", _loopCache[i]);
+    if(i % 32 == 31 || i == _loopCached-1)
+      _serial.PrintLine(line);
+  }
+  #endif
+  return true;
+}
+
+bool Player::VgmVerify()
+{
+  if(_header.indent != VGM_IDENT && _header.indent != OPM_IDENT) //VGM. Indent check
+  {
+    StartTrack(NEXT);
+    return false;
+  }
+  _storage.Release(); //The clock generator shares the card's bus, which FillBuffer() left streaming
+  _bus.SetClock(_header.ym2151Clock);
+  _serial.PrintLine("VGM OK!");
+  ReadGD3();
+  _serial.PrintLine(_gd3.Text(GD3_GAME));
+  _serial.PrintLine(_gd3.Text(GD3_TRACK));
+  _serial.PrintLine(_gd3.Text(GD3_SYSTEM));
+  _serial.PrintLine(_gd3.Text(GD3_DATE));
+  Printf("Version: %lX", (unsigned long)_header.version);
+  DrawTrackInfo();
+  _ready = true;
+  return true;
+}
+
+void Player::ReadGD3()
+{
+  uint32_t prevLocation = _storage.Position();
+  uint32_t tag = 0;
+  uint8_t v[GD3_CHUNK_SIZE];
+  _gd3.Reset();
+  _storage.Seek(_header.gd3Offset);
+  if(_storage.Read(v, 12) == 12)
+    tag = v[0] + v[1] + v[2] + v[3]; //Add up the GD3 tag bytes for an easy comparison.
+  if(tag != 0xFE) //GD3 tag bytes do not sum up to the constant. No valid GD3 data detected.
+  {Printf("INVALID GD3 SUM:%lu", (unsigned long)tag); _storage.Seek(prevLocation); return;}
+  _gd3.size = uint32_t(v[8] + (v[9] << 8) + (v[10] << 16) + (v[11] << 24)); //Skipping version info
+  //UTF-16LE in, UTF-8 out. Each NUL ends a field
+  uint32_t left = _gd3.size & ~1UL;
+  uint16_t high = 0; //Pending high surrogate
+  while(left > 0 && _gd3.field < GD3_FIELDS)
+  {
+    int got = _storage.Read(v, left < GD3_CHUNK_SIZE ? left : GD3_CHUNK_SIZE);
+    if(got < 2)
+      break;
+    left -= got & ~1;
+    for(int i = 0; i+1<got; i += 2)
+    {
+      uint16_t c = v[i] | (v[i+1] << 8);
+      if(c >= 0xD800 && c < 0xDC00)
+      {
+        high = c;
+        continue;
+      }
+      if(c >= 0xDC00 && c < 0xE000)
+      {
+        if(high)
+          _gd3.Append(0x10000 + ((uint32_t)(high - 0xD800) << 10) + (c - 0xDC00));
+        else
+          _gd3.Append('?');
+      }
+      else if(c == 0)
+        _gd3.EndField();
+      else
+      {
+        if(high)
+          _gd3.Append('?');
+        _gd3.Append(c);
+      }
+      high = 0;
+    }
+  }
+  if(_gd3.field < GD3_FIELDS) //Tag cut short
+    _gd3.EndField();
+  _storage.Seek(prevLocation);
+}
+
+//Header layouts. Offsets are where the field sits in the file, version is the first VGM version that has it
+struct HeaderField
+{
+  uint8_t offset;
+  uint16_t version;
+  uint32_t VGMHeader::*field;
+};
+
+static const HeaderField vgmFields[] =
+{
+  {0x04, 0, &VGMHeader::EoF}, {0x08, 0, &VGMHeader::version},
+  {0x0C, 0, &VGMHeader::sn76489Clock}, {0x10, 0, &VGMHeader::ym2413Clock},
+  {0x14, 0, &VGMHeader::gd3Offset}, {0x18, 0, &VGMHeader::totalSamples},
+  {0x1C, 0, &VGMHeader::loopOffset}, {0x20, 0, &VGMHeader::loopNumSamples},
+  {0x24, 0x101, &VGMHeader::rate}, {0x28, 0x110, &VGMHeader::snX},
+  {0x2C, 0x110, &VGMHeader::ym2612Clock}, {0x30, 0x110, &VGMHeader::ym2151Clock},
+  {0x34, 0x150, &VGMHeader::vgmDataOffset}, {0x38, 0x151, &VGMHeader::segaPCMClock},
+  {0x3C, 0x151, &VGMHeader::spcmInterface}, {0x40, 0x151, &VGMHeader::rf5C68clock},
+  {0x44, 0x151, &VGMHeader::ym2203clock}, {0x48, 0x151, &VGMHeader::ym2608clock},
+  {0x4C, 0x151, &VGMHeader::ym2610clock}, {0x50, 0x151, &VGMHeader::ym3812clock},
+  {0x54, 0x151, &VGMHeader::ym3526clock}, {0x58, 0x151, &VGMHeader::y8950clock},
+  {0x5C, 0x151, &VGMHeader::ymf262clock}, {0x60, 0x151, &VGMHeader::ymf278bclock},
+  {0x64, 0x151, &VGMHeader::ymf271clock}, {0x68, 0x151, &VGMHeader::ymz280Bclock},
+  {0x6C, 0x151, &VGMHeader::rf5C164clock}, {0x70, 0x151, &VGMHeader::pwmclock},
+  {0x74, 0x151, &VGMHeader::ay8910clock}, {0x78, 0x151, &VGMHeader::ayclockflags},
+  {0x7C, 0x160, &VGMHeader::vmlblm},
+  {0x80, 0x161, &VGMHeader::gbdgmclock}, {0x84, 0x161, &VGMHeader::nesapuclock},
+  {0x88, 0x161, &VGMHeader::multipcmclock}, {0x8C, 0x161, &VGMHeader::upd7759clock},
+  {0x90, 0x161, &VGMHeader::okim6258clock}, {0x94, 0x161, &VGMHeader::ofkfcf},
+  {0x98, 0x161, &VGMHeader::okim6295clock}, {0x9C, 0x161, &VGMHeader::k051649clock},
+  {0xA0, 0x161, &VGMHeader::k054539clock}, {0xA4, 0x161, &VGMHeader::huc6280clock},
+  {0xA8, 0x161, &VGMHeader::c140clock}, {0xAC, 0x161, &VGMHeader::k053260clock},
+  {0xB0, 0x161, &VGMHeader::pokeyclock}, {0xB4, 0x161, &VGMHeader::qsoundclock},
+  {0xB8, 0x171, &VGMHeader::scspclock}, {0xBC, 0x170, &VGMHeader::extrahdrofs},
+  {0xC0, 0x171, &VGMHeader::wonderswanclock}, {0xC4, 0x171, &VGMHeader::vsuClock},
+  {0xC8, 0x171, &VGMHeader::saa1099clock},
+};
+
+static const HeaderField opmFields[] = //See OPMStream.h
+{
+  {0x04, 0, &VGMHeader::EoF}, {0x08, 0, &VGMHeader::version},
+  {0x0C, 0, &VGMHeader::ym2151Clock}, {0x10, 0, &VGMHeader::totalSamples},
+  {0x14, 0, &VGMHeader::loopOffset}, {0x18, 0, &VGMHeader::loopNumSamples},
+  {0x1C, 0, &VGMHeader::vgmDataOffset}, {0x20, 0, &VGMHeader::gd3Offset},
+};
+
+static uint32_t headerWord(const uint8_t *raw, uint32_t offset)
+{
+  return raw[offset] | (raw[offset+1] << 8) | (raw[offset+2] << 16) | ((uint32_t)raw[offset+3] << 24);
+}
+
+//Fill header from the first length bytes of the file. Anything at or past the start of the command data
+//belongs to the commands and reads as zero, as do fields newer than the file's version.
+//VGM offsets are made absolute except EoF, which stays relative to 0x04. Returns true for an OPM stream
+bool Player::DecodeHeader(VGMHeader &header, const uint8_t *raw, uint32_t length)
+{
+  header.Reset();
+  if(length < 0x0C)
+    return false;
+  header.indent = headerWord(raw, 0);
+  bool compact = header.indent == OPM_IDENT;
+  uint32_t version = compact ? 0 : headerWord(raw, 0x08);
+  uint32_t dataStart = 0x40;
+  if(compact)
+    dataStart = length >= 0x20 && headerWord(raw, 0x1C) != 0 ? headerWord(raw, 0x1C) : OPM_HEADER_SIZE;
+  else if(version >= 0x150 && length >= 0x38 && headerWord(raw, 0x34) != 0)
+    dataStart = 0x34 + headerWord(raw, 0x34);
+  if(length > dataStart)
+    length = dataStart;
+
+  const HeaderField *table = compact ? opmFields : vgmFields;
+  uint8_t count = compact ? sizeof(opmFields)/sizeof(HeaderField) : sizeof(vgmFields)/sizeof(HeaderField);
+  for(uint8_t i = 0; i<count; i++)
+    if(version >= table[i].version && table[i].offset + 4u <= length)
+      header.*table[i].field = headerWord(raw, table[i].offset);
+  header.vgmDataOffset = dataStart;
+  if(compact)
+  {
+    //Offsets in an OPM stream are already absolute and it only carries the YM2151 clock
+    if(header.loopOffset == 0x00)
+      header.loopOffset = dataStart;
+    return true;
+  }
+  if(version < 0x110)
+    header.ym2151Clock = header.ym2413Clock; //Before 1.10 the YM2413 clock stood for every FM chip
+  if(header.loopOffset == 0x00)
+    header.loopOffset = dataStart;
+  else
+    header.loopOffset += 0x1C;
+  if(header.gd3Offset != 0x00)
+    header.gd3Offset += 0x14;
+  return false;
+}
+
+//Find where the command data ends and keep the start of the loop region in RAM. Refills wrap from _dataEnd
+//straight back to the loop point, so the loop is already in the command buffer when the parser reaches it.
+//Leaves the file positioned anywhere
+void Player::CacheLoop()
+{
+  uint32_t fileSize = _storage.Position() + _storage.Available();
+  uint32_t end = _header.gd3Offset != 0 ? _header.gd3Offset : (_compactStream ? _header.EoF : _header.EoF + 0x04);
+  if(end > fileSize || end <= _header.loopOffset)
+    end = fileSize;
+  _dataEnd = end;
+  uint32_t loopLength = _dataEnd > _header.loopOffset ? _dataEnd - _header.loopOffset : 0;
+  _storage.Seek(_header.loopOffset);
+  int got = _storage.Read(_loopCache, loopLength < LOOP_CACHE_SIZE ? loopLength : LOOP_CACHE_SIZE);
+  _loopCached = got > 0 ? got : 0;
+  _cacheCursor = _loopCached;
+  #if DEBUG
+  Printf("LOOP CACHED: %lu/%lu", (unsigned long)_loopCached, (unsigned long)loopLength);
+  #endif
+}
+
+//Copy the next stretch of the cached loop region into the command buffer
+bool Player::RefillFromCache()
+{
+  size_t space;
+  uint8_t *dst = _cmdBuffer.write_span(space);
+  uint32_t n = _loopCached - _cacheCursor;
+  if(n > space)
+    n = space;
+  memcpy(dst, _loopCache + _cacheCursor, n);
+  _cmdBuffer.commit_write(n);
+  _cacheCursor += n;
+  return false;
+}
+
+//Completely fill command buffer
+void Player::FillBuffer()
+{
+  while(!TopUpBuffer() || _reading){};
+}
+
+//Add to buffer from SD card. Reads straight into the free contiguous region of the ring buffer,
+//trimmed so each read ends on a file block boundary. Where the storage supports it the read runs in the
+//background and is committed by a later call, so the parser keeps working on what is already buffered.
+//At the end of the command data the reader wraps to the loop point. Returns true when nothing more can
+//be added right now
+bool Player::TopUpBuffer()
+{
+  if(_reading && CollectRead(false) <= 0)
+    return true; //Still running, or it failed
+  if(_cmdBuffer.full())
+    return true;
+  if(_cacheCursor < _loopCached)
+    return RefillFromCache();
+  uint32_t pos = _storage.Position();
+  if(pos >= _dataEnd)
+  {
+    //End of the command data, carry on from the loop point. The cached part comes from RAM
+    //and the card is repositioned past it well before the parser gets there
+    if(_dataEnd <= _header.loopOffset)
+      return true;
+    _cacheCursor = 0;
+    if(_header.loopOffset + _loopCached < _dataEnd)
+      _storage.Seek(_header.loopOffset + _loopCached);
+    return false;
+  }
+  uint32_t remaining = _storage.Available();
+  if(remaining > _dataEnd - pos)
+    remaining = _dataEnd - pos;
+  if(remaining == 0)
+    return true;
+  size_t space;
+  uint8_t *dst = _cmdBuffer.write_span(space);
+  bool wrapLimited = dst + space + 1 >= _cmdBuffer.elements + CMD_BUFFER_SIZE;
+  uint32_t toBoundary = SD_BLOCK_SIZE - (pos & (SD_BLOCK_SIZE-1));
+  uint32_t n = space < remaining ? space : remaining;
+  //Stop at the block boundary when the read starts off one, so the next read can run in the background,
+  //or when running low, as after a skip, so parsing resumes after one block instead of a long read
+  if(n > toBoundary && (toBoundary < SD_BLOCK_SIZE || _cmdBuffer.available() < REFILL_LOW_WATER))
+    n = toBoundary;
+  else if(n > toBoundary)
+    n = toBoundary + ((n - toBoundary) & ~(uint32_t)(SD_BLOCK_SIZE-1));
+  else if(n < toBoundary && n < remaining && !wrapLimited)
+    return true; //Wait until the reader frees a whole block instead of doing a partial read
+  _fetching = true;
+  uint32_t start = cycleCount();
+  if(_storage.BeginRead(dst, n))
+  {
+    _fetching = false;
+    _reading = true;
+    _readStart = start;
+    return true;
+  }
+  int got = _storage.Read(dst, n);
+  _fetching = false;
+  if(got <= 0)
+    return true;
+  _stats.RecordRefill(cycleCount() - start, got);
+  _cmdBuffer.commit_write(got);
+  _bufferPos = 0;
+  return false;
+}
+
+//Commit the background read once it completes. Nothing past the write index is visible to the parser until then.
+//Returns 0 while it is still running (never when waiting), otherwise what the read returned, -1 if none was running
+int Player::CollectRead(bool wait)
+{
+  if(!_reading)
+    return -1;
+  int got;
+  while((got = _storage.PollRead()) == 0)
+    if(!wait)
+      return 0;
+  _reading = false;
+  if(got > 0)
+  {
+    _stats.RecordRefill(cycleCount() - _readStart, got); //Time until the data landed, not time spent blocked
+    _cmdBuffer.commit_write(got);
+    _bufferPos = 0;
+  }
+  return got;
+}
+
+void Player::ClearBuffers()
+{
+  _bufferPos = 0;
+  _cmdBuffer.clear();
+}
+
+//Buffer exauhsted prematurely. Force replenish until something arrives. A pass can add nothing,
+//such as the one that wraps back to the loop point, so keep going until TopUpBuffer() gives up.
+//A skip running past what is buffered waits the same way, but that is counted with the skips
+void Player::WaitForData(bool skipping)
+{
+  if(!skipping)
+    _stats.RecordBufferUnderrun();
+  if(_streaming) //The host split a command across frames. Nothing to wait on
+    return;
+  while(_cmdBuffer.empty())
+  {
+    if(_reading)
+      CollectRead(true);
+    else if(TopUpBuffer() && !_reading)
+      return;
+  }
+}
+
+uint8_t Player::ReadBuffer()
+{
+  if(_cmdBuffer.empty())
+  {
+    WaitForData();
+    if(_cmdBuffer.empty()) //Nothing left to read. Don't pop, that would wrap the ring buffer
+      return 0;
+  }
+  _bufferPos++;
+  _cmdPos++;
+  return _cmdBuffer.pop_front_nc();
+}
+
+uint16_t Player::ReadBuffer16()
+{
+  uint16_t d;
+  uint8_t v0 = ReadBuffer();
+  uint8_t v1 = ReadBuffer();
+  d = uint16_t(v0 + (v1 << 8));
+  _bufferPos+=2;
+  _cmdPos+=2;
+  return d;
+}
+
+uint32_t Player::ReadBuffer32()
+{
+  uint32_t d;
+  uint8_t v0 = ReadBuffer();
+  uint8_t v1 = ReadBuffer();
+  uint8_t v2 = ReadBuffer();
+  uint8_t v3 = ReadBuffer();
+  d = uint32_t(v0 + (v1 << 8) + (v2 << 16) + (v3 << 24));
+  _bufferPos+=4;
+  _cmdPos+=4;
+  return d;
+}
+
+//Drop the next count bytes of the command stream. Whatever is buffered goes a span at a time, anything
+//beyond a block past that is stepped over by moving the read position instead of streaming it through
+void Player::SkipBuffer(uint32_t count)
+{
+  if(count > _cmdBuffer.available() + SD_BLOCK_SIZE)
+  {
+    uint32_t start = cycleCount();
+    CollectRead(true);
+    uint32_t buffered = _cmdBuffer.available();
+    if(count > buffered + SD_BLOCK_SIZE) //The read that just landed may have brought it within reach
+    {
+      uint32_t skip = count - buffered;
+      ClearBuffers();
+      _cmdPos += count;
+      //Next byte the buffer would have been filled with. Past the end of the command data refills
+      //wrap to the loop point, a data block never legitimately runs over it
+      uint32_t next = _cacheCursor < _loopCached ? _header.loopOffset + _cacheCursor : _storage.Position();
+      uint32_t target = _dataEnd - next > skip ? next + skip : _dataEnd;
+      if(_cacheCursor < _loopCached && target < _header.loopOffset + _loopCached)
+        _cacheCursor = target - _header.loopOffset; //Still inside the cached loop region, the card is already past it
+      else
+      {
+        _cacheCursor = _loopCached;
+        _storage.Seek(target);
+      }
+      TopUpBuffer(); //Start on what follows right away. The parser would otherwise find the buffer empty and block
+      _stats.RecordSkip(cycleCount() - start, skip);
+      return;
+    }
+  }
+  while(count > 0)
+  {
+    if(_cmdBuffer.empty())
+    {
+      WaitForData(true);
+      if(_cmdBuffer.empty()) //Nothing left to read
+        return;
+    }
+    size_t span;
+    _cmdBuffer.read_span(span);
+    if(span > count)
+      span = count;
+    _cmdBuffer.commit_read(span);
+    _bufferPos += span;
+    _cmdPos += span;
+    count -= span;
+  }
+}
+
+//Read 32 bits right off of the SD card.
+uint32_t Player::ReadSD32()
+{
+  uint32_t d;
+  uint8_t v[4];
+  _storage.Read(v, 4);
+  d = uint32_t(v[0] + (v[1] << 8) + (v[2] << 16) + (v[3] << 24));
+  return d;
+}
+
+//Play one sample at 44.1KHz: send every queued write due on or before it, then count it. The first tick
+//after a track starts plays sample 0. Writes wait out the chip's busy period here rather than spinning,
+//so a dense burst spreads over the following ticks instead of stalling the ISR, and only that wait shows
+//up as lateness
+void Player::Tick()
+{
+  if(!_ready)
+    return;
+  uint32_t now = _sampleClock;
+  for(;;)
+  {
+    size_t count;
+    ScheduledWrite *ev = _eventQueue.read_span(count);
+    size_t sent = 0;
+    while(sent < count && (int32_t)(ev[sent].time - now) <= 0 && !_bus.Busy())
+    {
+      _bus.Write(ev[sent].addr, ev[sent].data);
+      _stats.RecordLateness(now - ev[sent].time);
+      sent++;
+    }
+    _eventQueue.commit_read(sent);
+    if(sent == 0 || sent < count) //Carry on past the wrap point only if the whole span went out
+      break;
+  }
+  if((int32_t)(_parseTime - now) <= 0)
+  {
+    //Parser has fallen behind and more may be due on this sample, hold the clock until it catches up
+    if(!_clockHeld && now != 0)
+      _stats.RecordQueueUnderrun();
+    _clockHeld = true;
+    return;
+  }
+  _clockHeld = false;
+  _sampleClock = now + 1;
+}
+
+//Queue a register write for Tick() to send once the sample clock reaches _parseTime
+void Player::QueueWrite(uint8_t addr, uint8_t data)
+{
+  if(_seeking)
+  {
+    //AMD and PMD share a register. PMD is kept in the unused 0x1A
+    _seekRegs[addr == OPM_PMD_AMD && (data & 0x80) ? OPM_PMD_AMD+1 : addr] = data;
+    return;
+  }
+  data = TrackLevel(addr, data);
+  size_t space;
+  ScheduledWrite *ev = _eventQueue.write_span(space);
+  ev->time = _parseTime;
+  ev->addr = addr;
+  ev->data = data;
+  _eventQueue.commit_write(1);
+}
+
+//Parse ahead of the sample clock, timestamping each write with the running total of waits
+void Player::ScheduleCommands()
+{
+  for(int i = 0; i<MAX_PARSE_PER_LOOP; i++)
+  {
+    if(_eventQueue.full() || (int32_t)(_parseTime - _sampleClock) >= SCHEDULE_AHEAD)
+      return;
+    //Frames hold whole commands, so only parse what has arrived. From the card, start the next read
+    //and let it land during later passes rather than blocking on it, the queue still has a lead
+    if(_cmdBuffer.empty() && !_streaming && !_reading)
+      TopUpBuffer();
+    if(_cmdBuffer.empty() && (_streaming || _reading))
+      return;
+    if(_levelDirty)
+    {
+      if(!RefreshLevels())
+        return;
+      continue;
+    }
+    uint32_t start = cycleCount();
+    _parseTime += _compactStream ? ParseOPM() : ParseVGM();
+    _stats.RecordParse(cycleCount() - start);
+  }
+}
+
+//Samples waited by a VGM wait command whose opcode has just been read
+uint32_t Player::VgmWait(uint8_t cmd)
+{
+  switch(VGM_OP_KIND(vgmOpcodes[cmd]))
+  {
+    case VGM_WAIT:
+    return ReadBuffer16();
+    case VGM_WAIT_NTSC:
+    return 735;
+    case VGM_WAIT_PAL:
+    return 882;
+    case VGM_WAIT_SHORT:
+    return (cmd & 0x0F)+1;
+    default: //VGM_WAIT_DAC. Ignore the YM2612 DAC write, keep its wait
+    return cmd & 0x0F;
+  }
+}
+
+//Next command byte without consuming it. False if nothing is buffered
+bool Player::PeekBuffer(uint8_t &next)
+{
+  size_t count;
+  uint8_t *p = _cmdBuffer.read_span(count);
+  if(count == 0)
+    return false;
+  next = *p;
+  return true;
+}
+
+//Next VGM command byte, only if its operands are buffered too, so a batch never stops partway through a
+//command to wait on a refill. A data block's payload isn't counted, batching stops at one anyway
+bool Player::PeekVGM(uint8_t &next)
+{
+  return PeekBuffer(next) && _cmdBuffer.available() > VGM_OP_LENGTH(vgmOpcodes[next]);
+}
+
+//Next OPM stream command byte, only if the whole command is buffered
+bool Player::PeekOPM(uint8_t &next)
+{
+  if(!PeekBuffer(next))
+    return false;
+  uint8_t operands = 0;
+  if(next == OPM_WRITE_LOW || next == OPM_WAIT16)
+    operands = 2;
+  else if(next >= OPM_MIN_DIRECT_REG || next == OPM_WAIT8)
+    operands = 1;
+  return _cmdBuffer.available() > operands;
+}
+
+//Execute next VGM command set. Return back wait time in samples.
+//Runs of writes are queued together and runs of waits are summed, along with any other chip's commands
+//between them, so each run costs one dispatch. Only whole commands already buffered are looked ahead at
+uint32_t Player::ParseVGM()
+{
+  uint8_t cmd = ReadBuffer();
+  uint8_t op = vgmOpcodes[cmd];
+  uint8_t next;
+  _stats.RecordCommand();
+  switch(VGM_OP_KIND(op))
+  {
+    case VGM_WRITE:
+    {
+      for(;;)
+      {
+        uint8_t a = ReadBuffer();
+        uint8_t d = ReadBuffer();
+        QueueWrite(a, d);
+        if(_eventQueue.full() || !PeekVGM(next) || VGM_OP_KIND(vgmOpcodes[next]) != VGM_WRITE)
+          return 0;
+        ReadBuffer();
+        _stats.RecordCommand();
+      }
+    }
+    case VGM_WAIT:
+    case VGM_WAIT_NTSC:
+    case VGM_WAIT_PAL:
+    case VGM_WAIT_SHORT:
+    case VGM_WAIT_DAC:
+    {
+      uint32_t wait = VgmWait(cmd);
+      while(wait < SCHEDULE_AHEAD && PeekVGM(next))
+      {
+        uint8_t kind = VGM_OP_KIND(vgmOpcodes[next]);
+        if(kind == VGM_SKIP)
+        {
+          ReadBuffer();
+          SkipBuffer(VGM_OP_LENGTH(vgmOpcodes[next]));
+        }
+        else if(kind >= VGM_WAIT && kind <= VGM_WAIT_DAC)
+          wait += VgmWait(ReadBuffer());
+        else
+          break;
+        _stats.RecordCommand();
+      }
+      return wait;
+    }
+    case VGM_DATA_BLOCK: //Ignore PCM data blocks
+    {
+      SkipBuffer(2); //0x66, datatype
+      uint32_t pcmSize = ReadBuffer32() & 0x7FFFFFFF; //Payload size;
+      SkipBuffer(pcmSize);
+      return 0;
+    }
+    case VGM_END:
+    LoopTrack();
+    return 0;
+    case VGM_SKIP: //Other chips
+    SkipBuffer(VGM_OP_LENGTH(op));
+    return 0;
+    default:
+    _commandFailed = true;
+    _failedCmd = cmd;
+    return 0;
+  }
+}
+
+//Execute next command of a precompiled OPM stream. Return back wait time in samples.
+//Runs of writes are queued in one dispatch, like ParseVGM(). vgm2opm has already merged the waits
+uint32_t Player::ParseOPM()
+{
+  uint8_t cmd = ReadBuffer();
+  _stats.RecordCommand();
+  if(cmd >= OPM_MIN_DIRECT_REG || cmd == OPM_WRITE_LOW)
+  {
+    for(;;)
+    {
+      if(cmd == OPM_WRITE_LOW)
+        cmd = ReadBuffer();
+      QueueWrite(cmd, ReadBuffer());
+      if(_eventQueue.full() || !PeekOPM(cmd) || (cmd < OPM_MIN_DIRECT_REG && cmd != OPM_WRITE_LOW))
+        return 0;
+      ReadBuffer();
+      _stats.RecordCommand();
+    }
+  }
+  switch(cmd)
+  {
+    case OPM_WAIT8:
+    return ReadBuffer()+1;
+    case OPM_WAIT16:
+    return ReadBuffer16();
+    case OPM_END:
+    LoopTrack();
+    return 0;
+    default:
+    _commandFailed = true;
+    _failedCmd = cmd;
+    return 0;
+  }
+}
+
+//Skip leading and trailing whitespace. Returns the start of the name and its trimmed length in len
+const char* Player::TrimName(const char *name, size_t &len)
+{
+  while(isspace(*name))
+    name++;
+  len = strlen(name);
+  while(len > 0 && isspace(name[len-1]))
+    len--;
+  return name;
+}
+
+//32 bit FNV-1a
+uint32_t Player::HashName(const char *name, size_t len)
+{
+  uint32_t hash = 2166136261UL;
+  for(size_t i = 0; i<len; i++)
+  {
+    hash ^= (uint8_t)name[i];
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+//Add a track's file name to the request lookup table
+void Player::IndexName(uint16_t track, const char *name)
+{
+  size_t len;
+  name = TrimName(name, len);
+  uint32_t hash = HashName(name, len);
+  uint16_t bucket = hash & (NAME_BUCKETS-1);
+  _nameTag[track] = hash >> 24;
+  _nameNext[track] = _nameBucket[bucket];
+  _nameBucket[bucket] = track;
+}
+
+//Look up a track by file name. Only tracks whose hash matches are opened to compare the name on the card.
+//Names past the index are searched for by walking the directory. Returns _numberOfFiles when there is no match
+uint32_t Player::FindTrack(const char *request)
+{
+  size_t len;
+  request = TrimName(request, len);
+  uint32_t hash = HashName(request, len);
+  size_t nameLen;
+  const char *name;
+  for(uint16_t i = _nameBucket[hash & (NAME_BUCKETS-1)]; i != NO_TRACK; i = _nameNext[i])
+  {
+    if(_nameTag[i] != (uint8_t)(hash >> 24))
+      continue;
+    if(!_storage.EntryName(_fileIndex[i], _fileName, MAX_FILE_NAME_SIZE))
+      continue;
+    name = TrimName(_fileName, nameLen);
+    if(nameLen == len && memcmp(name, request, len) == 0)
+      return i;
+  }
+  if(_numberOfFiles <= MAX_INDEXED_FILES)
+    return _numberOfFiles;
+  uint16_t dirIndex;
+  uint32_t i = 0;
+  _storage.Rewind();
+  while(i < _numberOfFiles && _storage.NextEntry(dirIndex, _fileName, MAX_FILE_NAME_SIZE))
+  {
+    if(i++ < MAX_INDEXED_FILES)
+      continue;
+    name = TrimName(_fileName, nameLen);
+    if(nameLen == len && memcmp(name, request, len) == 0)
+    {
+      //Remembered so opening it doesn't walk the directory again
+      _walkTrack = i-1;
+      _walkEntry = dirIndex;
+      return i-1;
+    }
+  }
+  return _numberOfFiles;
+}
+
+//Directory entry of a track, NO_TRACK if the card no longer has it. Tracks past the index are counted
+//off from the start of the directory, the way Begin() numbered them
+uint16_t Player::TrackEntry(uint32_t track)
+{
+  if(track < MAX_INDEXED_FILES)
+    return _fileIndex[track];
+  if(track == _walkTrack)
+    return _walkEntry;
+  uint16_t dirIndex;
+  uint32_t i = 0;
+  _storage.Rewind();
+  while(_storage.NextEntry(dirIndex, _fileName, MAX_FILE_NAME_SIZE))
+  {
+    if(i++ == track)
+    {
+      _walkTrack = track;
+      _walkEntry = dirIndex;
+      return dirIndex;
+    }
+  }
+  return NO_TRACK;
+}
+
+//xorshift32 in [0, max), stirred with the cycle counter on every call the way randomSeed(micros()) used to be
+uint32_t Player::Random(uint32_t max)
+{
+  _rng ^= cycleCount();
+  if(_rng == 0)
+    _rng = 1;
+  _rng ^= _rng << 13;
+  _rng ^= _rng >> 17;
+  _rng ^= _rng << 5;
+  return _rng % max;
+}
+
+//End of the command data. TopUpBuffer() has already wrapped the stream, so the loop plays on from the command buffer
+void Player::LoopTrack()
+{
+  _cmdPos = 0;
+  _loopCount++;
+}
+
+void Player::Printf(const char *format, ...)
+{
+  char line[MAX_FILE_NAME_SIZE+32];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  _serial.PrintLine(line);
+}
+
+//Poll the serial port. Single character commands run as soon as they arrive. Commands with an argument
+//are collected into _line a few bytes per pass and run at CR, LF or a pause in the input
+void Player::HandleSerialIn()
+{
+  bool newTrack = false;
+  for(int i = 0; i<SERIAL_BYTES_PER_LOOP && _serial.Available() > 0; i++)
+  {
+    uint8_t serialCmd = _serial.Read();
+    _lineLast = cycleCount();
+    if(_frameGot > 0)
+    {
+      //After a sync byte, collect what may be a STREAM_OPEN frame. A byte that can't be part of one
+      //drops it and is taken as a command
+      if((_frameGot == 1 && serialCmd != STREAM_OPEN) || (_frameGot == 2 && serialCmd != STREAM_OPEN_SIZE))
+        _frameGot = 0;
+      else
+      {
+        _frame[_frameGot-1] = serialCmd;
+        if(++_frameGot < STREAM_OPEN_SIZE + 4)
+          continue;
+        _frameGot = 0;
+        if(OpenStream())
+          return;
+        continue;
+      }
+    }
+    if(_lineLength > 0)
+    {
+      if(serialCmd == '\r' || serialCmd == '\n')
+        newTrack |= RunLine();
+      else if(_lineLength < SERIAL_LINE_SIZE-1)
+        _line[_lineLength++] = serialCmd;
+      continue;
+    }
+    switch(serialCmd)
+    {
+      case STREAM_SYNC:
+        _frameGot = 1;
+      break;
+      case '+':
+        newTrack = StartTrack(NEXT);
+      break;
+      case '-':
+        newTrack = StartTrack(PREV);
+      break;
+      case '*':
+        newTrack = StartTrack(RND);
+      break;
+      case '/':
+        SetPlayMode(SHUFFLE);
+      break;
+      case '.':
+        SetPlayMode(LOOP);
+      break;
+      case '?':
+        _serial.PrintLine(_gd3.Text(GD3_GAME));
+        _serial.PrintLine(_gd3.Text(GD3_TRACK));
+        _serial.PrintLine(_gd3.Text(GD3_SYSTEM));
+        _serial.PrintLine(_gd3.Text(GD3_DATE));
+        Printf("Version: %lX", (unsigned long)_header.version);
+        _bus.Dump(_serial);
+      break;
+      case '!':
+
+      break;
+      case '#':
+        _stats.Dump(_serial);
+      break;
+      case 'r':
+      case 's':
+      case 'v':
+        _line[0] = serialCmd;
+        _lineLength = 1;
+      break;
+      default:
+        continue;
+    }
+  }
+  if((_lineLength > 0 || _frameGot > 0) && (uint32_t)(cycleCount() - _lineLast) >= SERIAL_LINE_TIMEOUT_US * CYCLE_TICKS_PER_US)
+  {
+    _frameGot = 0;
+    if(_lineLength > 0)
+      newTrack |= RunLine();
+  }
+  if(newTrack)
+  {
+    VgmVerify();
+    PrepareChips();
+  }
+}
+
+//Run the command line in _line. Returns true if a new track started
+bool Player::RunLine()
+{
+  _line[_lineLength] = 0;
+  _lineLength = 0;
+  const char *arg = _line+1;
+  if(*arg == ':')
+    arg++;
+  switch(_line[0])
+  {
+    case 'r':
+    return StartTrack(REQUEST, arg);
+    case 's':
+      SeekTrack(strtoul(arg, NULL, 10) * 44100);
+    return false;
+    case 'v':
+    {
+      unsigned long dB = strtoul(arg, NULL, 10);
+      SetVolume(dB > 95 ? 95 : dB);
+    }
+    return false;
+  }
+  return false;
+}
+
+//Jump to a sample of the current track. The track is parsed from the start up to there without
+//timing, keeping the last value written to each register, and the chip is reloaded with those.
+//Key on writes are left out so no note is left hanging. The work is spread over Loop() passes by SeekStep()
+void Player::SeekTrack(uint32_t sample)
+{
+  if((!_ready && !_seeking) || _streaming)
+    return;
+  _ready = false;
+  CollectRead(true);
+  _eventQueue.clear();
+  _sampleClock = 0;
+  _parseTime = 0;
+  _cmdPos = 0;
+  _loopCount = 0;
+  ClearBuffers();
+  _cacheCursor = _loopCached;
+  _storage.Seek(_header.vgmDataOffset);
+  memset(_seekRegs, 0, sizeof(_seekRegs));
+  _seeking = true;
+  _seekTarget = sample;
+  _seekReplay = SEEK_PARSING;
+  _commandFailed = false;
+}
+
+//One slice of a seek. Parses up to SEEK_BYTES_PER_LOOP bytes of what the card has delivered, never
+//waiting on a refill, then reloads the chip SEEK_REGS_PER_LOOP registers at a time without spinning on busy
+void Player::SeekStep()
+{
+  if(_seekReplay == SEEK_PARSING)
+  {
+    uint32_t parsed = 0;
+    while(_parseTime < _seekTarget && _loopCount < _maxLoops && !_commandFailed)
+    {
+      if(parsed >= SEEK_BYTES_PER_LOOP)
+        return;
+      //Short of a whole command, take what a refill gives and come back once a background read lands.
+      //Only the tail of a track that doesn't loop is parsed from a nearly empty buffer
+      if(_cmdBuffer.available() < SEEK_MIN_BUFFERED && (_reading || !TopUpBuffer() || _reading))
+        return;
+      uint32_t before = _cmdPos;
+      _parseTime += _compactStream ? ParseOPM() : ParseVGM();
+      parsed += _cmdPos >= before ? _cmdPos - before : _cmdPos; //LoopTrack() restarts _cmdPos
+    }
+    CollectRead(true);
+    PrepareChips();
+    _seekReplay = 0;
+  }
+  for(uint16_t n = 0; n<SEEK_REGS_PER_LOOP && _seekReplay < 256; n++)
+  {
+    uint16_t i = _seekReplay;
+    uint8_t addr = i == OPM_PMD_AMD+1 ? OPM_PMD_AMD : i;
+    uint8_t data = TrackLevel(addr, _seekRegs[i]);
+    if(i != OPM_KEY_ON && data != 0) //Registers are all 0 after the reset
+    {
+      if(_bus.Busy())
+        return;
+      _bus.Write(addr, data);
+    }
+    _seekReplay++;
+  }
+  if(_seekReplay < 256)
+    return;
+  _seeking = false;
+  _sampleClock = _parseTime;
+  _ready = true;
+}
+
+//Quieten playback by dB. The YM2151 has no master volume, so the TL of every carrier slot is raised
+void Player::SetVolume(uint8_t dB)
+{
+  uint16_t steps = dB * 4 / 3;
+  _attenuation = steps > 127 ? 127 : steps;
+  _levelDirty = 0xFF;
+}
+
+//Keep track of writes that decide the volume and return data with the attenuation applied
+uint8_t Player::TrackLevel(uint8_t addr, uint8_t data)
+{
+  //Carrier slots of each algorithm. Bits are M1, M2, C1, C2
+  static const uint8_t carriers[8] = {0x8, 0x8, 0x8, 0x8, 0xC, 0xE, 0xE, 0xF};
+  if(addr >= OPM_CONNECT && addr < OPM_CONNECT+8)
+  {
+    uint8_t ch = addr & 7;
+    if(_attenuation && (data & 7) != _connect[ch])
+      _levelDirty |= 1 << ch;
+    _connect[ch] = data & 7;
+  }
+  else if(addr >= OPM_TOTAL_LEVEL && addr < OPM_TOTAL_LEVEL+32)
+  {
+    uint8_t slot = addr - OPM_TOTAL_LEVEL;
+    _level[slot] = data;
+    if(carriers[_connect[slot & 7]] & (1 << (slot >> 3)))
+    {
+      uint16_t tl = (data & 0x7F) + _attenuation;
+      data = (data & 0x80) | (tl > 0x7F ? 0x7F : tl);
+    }
+  }
+  return data;
+}
+
+//Rewrite the TLs of one channel marked in _levelDirty, at the current parse time. False if the event
+//queue has no room for them yet
+bool Player::RefreshLevels()
+{
+  if(_eventQueue.capacity() - _eventQueue.available() < 4)
+    return false;
+  uint8_t ch = __builtin_ctz(_levelDirty);
+  _levelDirty &= ~(1 << ch);
+  for(uint8_t op = 0; op<4; op++)
+    QueueWrite(OPM_TOTAL_LEVEL + op*8 + ch, _level[op*8 + ch]);
+  return true;
+}
+
+//A whole STREAM_OPEN frame is in _frame. Start the stream if it checks out, returns true if it did
+bool Player::OpenStream()
+{
+  const uint8_t *payload = _frame+2;
+  uint8_t check = 0;
+  for(uint8_t i = 0; i<STREAM_OPEN_SIZE+3; i++)
+    check += _frame[i];
+  uint32_t magic = uint32_t(payload[0] + (payload[1] << 8) + (payload[2] << 16) + (uint32_t(payload[3]) << 24));
+  if(check != 0 || magic != STREAM_MAGIC)
+    return false;
+  if(payload[4] != STREAM_VERSION)
+  {
+    uint8_t error = STREAM_ERR_VERSION;
+    SendFrame(STREAM_ERROR, &error, 1);
+    return false;
+  }
+  StartStream();
+  _storage.Release();
+  _bus.SetClock(uint32_t(payload[5] + (payload[6] << 8) + (payload[7] << 16) + (uint32_t(payload[8]) << 24)));
+  PrepareChips();
+  return true;
+}
+
+//Take the player off the card. The host's STREAM_OPEN has just been accepted, PollStream() answers it with credit
+void Player::StartStream()
+{
+  CollectRead(true);
+  _ready = false;
+  _seeking = false;
+  _streaming = true;
+  _streamClosing = false;
+  _compactStream = true;
+  _credit = 0;
+  _frameGot = 0;
+  _streamLast = cycleCount();
+  _cmdPos = 0;
+  _eventQueue.clear();
+  _sampleClock = 0;
+  _parseTime = 0;
+  _stats.Reset();
+  _loopCount = 0;
+  ClearBuffers();
+  _gd3.Reset();
+  _display.ShowMessage("Streaming", "from serial");
+}
+
+//End the stream, reporting error if it isn't 0. The player then idles, keeping the stream's stats,
+//until a track is picked or the next stream starts
+void Player::StopStream(uint8_t error)
+{
+  if(error)
+    SendFrame(STREAM_ERROR, &error, 1);
+  else
+    SendFrame(STREAM_DONE, NULL, 0);
+  _ready = false;
+  _streaming = false;
+  _streamClosing = false;
+  _compactStream = false; //The card file still open is no stream, nothing may go on parsing it as one
+  _credit = 0;
+  _frameGot = 0;
+  _cmdPos = 0;
+  ClearBuffers();
+  _eventQueue.clear();
+  _sampleClock = 0;
+  _parseTime = 0;
+  _display.ShowMessage("Stream", error == STREAM_ERR_STOPPED ? "stopped" : error ? "failed" : "ended");
+}
+
+void Player::SendFrame(uint8_t type, const uint8_t *payload, uint8_t length)
+{
+  uint8_t head[3] = {STREAM_SYNC, type, length};
+  uint8_t check = type + length;
+  for(uint8_t i = 0; i<length; i++)
+    check += payload[i];
+  check = -check;
+  _serial.Write(head, 3);
+  if(length)
+    _serial.Write(payload, length);
+  _serial.Write(&check, 1);
+}
+
+//Receive frames, hand back credit as the parser frees up room and end the stream once it has played out
+void Player::PollStream()
+{
+  while(_streaming && _serial.Available() > 0)
+  {
+    uint8_t c = _serial.Read();
+    _streamLast = cycleCount();
+    if(_frameGot == 0)
+    {
+      if(c == STREAM_SYNC)
+        _frameGot = 1;
+      continue;
+    }
+    _frame[_frameGot-1] = c;
+    _frameGot++;
+    if(_frameGot >= 3 && _frame[1] > STREAM_MAX_PAYLOAD)
+    {
+      StopStream(STREAM_ERR_FRAME);
+      return;
+    }
+    if(_frameGot >= 3 && _frameGot == _frame[1] + 4)
+    {
+      _frameGot = 0;
+      HandleFrame();
+    }
+  }
+  if(!_streaming)
+    return;
+  uint32_t space = _cmdBuffer.capacity() - _cmdBuffer.available();
+  if(space >= _credit + (uint32_t)STREAM_CREDIT_STEP)
+  {
+    uint16_t grant = space - _credit;
+    uint8_t v[2] = {uint8_t(grant), uint8_t(grant >> 8)};
+    _credit += grant;
+    _streamLast = cycleCount(); //The host gets a whole timeout to answer
+    SendFrame(STREAM_CREDIT, v, 2);
+  }
+  //Start the clock once the parser has a lead, or can't get one. A stream of writes with no wait in it
+  //never gets a lead, it starts when the queue fills or the host closes
+  if(!_ready && ((int32_t)_parseTime >= SCHEDULE_AHEAD || _eventQueue.full() || _streamClosing))
+    _ready = true;
+  if(!_cmdBuffer.empty() || !_eventQueue.empty() || (int32_t)(_parseTime - _sampleClock) > 0)
+    return;
+  if(_streamClosing)
+    StopStream(0);
+  else if((uint32_t)(cycleCount() - _streamLast) >= STREAM_IDLE_TIMEOUT_US * CYCLE_TICKS_PER_US)
+    StopStream(STREAM_ERR_TIMEOUT); //Played out and nothing more from the host, which has most likely gone away
+}
+
+//A whole frame is in _frame: type, length, payload, check
+void Player::HandleFrame()
+{
+  uint8_t type = _frame[0];
+  uint8_t length = _frame[1];
+  const uint8_t *payload = _frame+2;
+  uint8_t check = 0;
+  for(uint8_t i = 0; i<length+3; i++)
+    check += _frame[i];
+  if(check != 0)
+  {
+    StopStream(STREAM_ERR_CHECK);
+    return;
+  }
+  switch(type)
+  {
+    case STREAM_DATA:
+    {
+      if(length > _credit)
+      {
+        StopStream(STREAM_ERR_CREDIT);
+        return;
+      }
+      _credit -= length;
+      while(length > 0)
+      {
+        size_t space;
+        uint8_t *dst = _cmdBuffer.write_span(space);
+        size_t n = space < length ? space : length;
+        memcpy(dst, payload, n);
+        _cmdBuffer.commit_write(n);
+        payload += n;
+        length -= n;
+      }
+      return;
+    }
+    case STREAM_CLOSE:
+    _streamClosing = true;
+    return;
+  }
+  StopStream(STREAM_ERR_FRAME);
+}
+
+void Player::Loop()
+{
+  _stats.RecordBufferLevel(_cmdBuffer.available());
+  if(_streaming)
+    PollStream();
+  else if(_seeking)
+    SeekStep();
+  else if(_ready)
+    TopUpBuffer();
+  if(_ready || _streaming)
+    ScheduleCommands();
+  if((int32_t)(_parseTime - _sampleClock) >= DISPLAY_MIN_AHEAD || !_ready)
+    _display.Update();
+  if(_loopCount >= _maxLoops && _playMode != LOOP && !_streaming && !_seeking)
+  {
+    if(_playMode == SHUFFLE)
+      ChangeTrack(RND);
+    if(_playMode == IN_ORDER)
+      ChangeTrack(NEXT);
+  }
+  if((_serial.Available() > 0 || _lineLength > 0 || _frameGot > 0) && !_streaming)
+    HandleSerialIn();
+  #if DEBUG
+  if(_commandFailed)
+  {
+    _commandFailed = false;
+    Printf("CMD ERROR: %X", _failedCmd);
+  }
+  #endif
+}
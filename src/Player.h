@@ -0,0 +1,196 @@
+#ifndef PLAYER_H_
+#define PLAYER_H_
+#include <stdint.h>
+#include "Hal.h"
+#include "TrackStructs.h"
+#include "PlaybackStats.h"
+#include "ringbuffer.h"
+#include "SerialStream.h"
+
+#define DEBUG false //Set this to true for a detailed printout of the header data & any errored command bytes
+
+//SD & File Streaming
+#define MAX_FILE_NAME_SIZE 128
+#define MAX_INDEXED_FILES 256 //Tracks indexed in Begin(). The index costs 5.5 bytes of RAM per track, later ones are found by walking the directory
+#define NAME_BUCKETS 64
+#define NO_TRACK 0xFFFF
+
+//Buffers
+#define CMD_BUFFER_SIZE 4096 //Eight card blocks, the smallest size that keeps the queue fed at 400 samples a block
+#define LOOP_CACHE_SIZE 1024 //Start of the loop region kept in RAM. Loops that fit entirely are never read from the card again
+#define SD_BLOCK_SIZE 512
+#define REFILL_LOW_WATER (CMD_BUFFER_SIZE/4) //Below this many buffered bytes the card is read a block per pass, so no read eats the queue's lead
+#define VGM_HEADER_SIZE 0x100 //Header bytes read in one go when a track opens. Later fields read as zero
+
+//Scheduler
+#define EVENT_QUEUE_SIZE 128 //Writes parsed but not yet sent. Dense bursts must still cover a slow card read, 64 runs dry
+#define SCHEDULE_AHEAD 2205 //Parse up to 50mS ahead of the sample clock
+#define MAX_PARSE_PER_LOOP 64 //Commands parsed per Loop() pass, so serial and buttons still get polled
+#define DISPLAY_MIN_AHEAD (SCHEDULE_AHEAD/2) //Samples that must be queued before a display slice is sent
+#define SEEK_BYTES_PER_LOOP 512 //Command bytes parsed per Loop() pass while seeking
+#define SEEK_REGS_PER_LOOP 32 //Registers reloaded per Loop() pass once a seek has parsed up to its target
+#define SEEK_MIN_BUFFERED 8 //Bytes that hold any whole command, a data block header being the longest
+#define SEEK_PARSING 0xFFFF //_seekReplay while the seek is still parsing
+
+//Serial commands
+#define SERIAL_LINE_SIZE (MAX_FILE_NAME_SIZE+3) //Command letter, colon, argument and NUL
+#define SERIAL_BYTES_PER_LOOP 16 //Input bytes handled per Loop() pass
+#define SERIAL_LINE_TIMEOUT_US 100000 //A command line without CR or LF ends once input pauses this long
+
+//YM2151 registers the player looks at
+#define OPM_KEY_ON 0x08
+#define OPM_PMD_AMD 0x19 //AMD, or PMD when bit 7 is set
+#define OPM_CONNECT 0x20 //RL, FB and the CON algorithm of channels 0-7
+#define OPM_TOTAL_LEVEL 0x60 //TL of the 32 slots: M1, M2, C1 then C2 of channels 0-7
+
+struct ScheduledWrite
+{
+  uint32_t time; //Sample the write is due on
+  uint8_t addr;
+  uint8_t data;
+};
+
+//File streaming, command parsing and write scheduling. Only talks to the board through the Hal.h interfaces,
+//so the same code runs on the STM32 and in the host build
+class Player
+{
+private:
+  typedef ringbuffer_t<uint8_t, CMD_BUFFER_SIZE, uint8_t> RingBuffer;
+  typedef ringbuffer_t<ScheduledWrite, EVENT_QUEUE_SIZE, uint8_t> EventQueue;
+
+  TrackStorage &_storage;
+  ChipBus &_bus;
+  SampleTimer &_timer;
+  Display &_display;
+  SerialPort &_serial;
+
+  VGMHeader _header;
+  GD3 _gd3;
+  PlaybackStats _stats; //Timing instrumentation, dumped as CSV with the '#' serial command
+
+  //Track index
+  char _fileName[MAX_FILE_NAME_SIZE];
+  uint32_t _numberOfFiles;
+  uint32_t _currentFileNumber;
+  uint16_t _fileIndex[MAX_INDEXED_FILES]; //Directory entry of each track, built once in Begin() so any track opens without a directory walk
+  uint16_t _nameBucket[NAME_BUCKETS]; //First track whose name hashes to each bucket
+  uint16_t _nameNext[MAX_INDEXED_FILES]; //Next track in the same bucket
+  uint8_t _nameTag[MAX_INDEXED_FILES]; //Top byte of each name's hash, checked before going to the card
+  uint32_t _walkTrack; //Last track past the index found by a directory walk, 0 for none
+  uint16_t _walkEntry; //Its directory entry
+
+  //Buffers
+  RingBuffer _cmdBuffer;
+  uint8_t _loopCache[LOOP_CACHE_SIZE];
+  uint32_t _loopCached; //Bytes of the loop region held in _loopCache
+  uint32_t _cacheCursor; //Next _loopCache byte to refill from. Refills come from the card once it reaches _loopCached
+  uint32_t _dataEnd; //File offset just past the end of the command data, where refills wrap back to the loop point
+  uint32_t _bufferPos;
+  uint32_t _cmdPos;
+
+  //Scheduler
+  EventQueue _eventQueue;
+  volatile uint32_t _sampleClock; //Samples played since the track started, advanced by Tick()
+  volatile uint32_t _parseTime; //Sample the next parsed command is due on
+  bool _clockHeld;
+
+  //VGM Variables
+  uint16_t _loopCount;
+  uint8_t _maxLoops;
+  bool _fetching;
+  bool _reading; //A background read into the command buffer is running
+  uint32_t _readStart;
+  volatile bool _ready;
+  bool _compactStream; //Track is a precompiled OPM stream (see OPMStream.h) rather than raw VGM
+
+  //Serial streaming (see SerialStream.h)
+  bool _streaming; //Commands come from the serial port instead of the card
+  bool _streamClosing; //Host has sent everything, play out what is buffered
+  uint16_t _credit; //Payload bytes granted to the host and not received yet
+  uint8_t _frame[STREAM_MAX_PAYLOAD+3]; //Frame being received, from its type byte on
+  uint8_t _frameGot; //Bytes of _frame received. 0 while looking for STREAM_SYNC
+  uint32_t _streamLast; //cycleCount() of the last byte from the host, or of the last credit sent
+
+  //Serial command line, filled a few bytes per Loop() pass
+  char _line[SERIAL_LINE_SIZE];
+  uint8_t _lineLength; //0 while no line command is being received
+  uint32_t _lineLast; //cycleCount() of the last byte of the line
+
+  //Volume. Carrier slots, picked by each channel's algorithm, are attenuated as their TL is written
+  uint8_t _attenuation; //TL steps of 0.75dB
+  uint8_t _connect[8]; //CON of each channel
+  uint8_t _level[32]; //TL of each slot as the track wrote it
+  uint8_t _levelDirty; //Channels whose TLs need rewriting after a volume or algorithm change
+
+  //Seek, run a slice per Loop() pass
+  bool _seeking;
+  uint32_t _seekTarget; //Sample to parse up to
+  uint16_t _seekReplay; //Next register to reload into the chip, SEEK_PARSING until the target is reached
+  uint8_t _seekRegs[256]; //Last value written to each register, which the parser stores here instead of queueing
+  PlayMode _playMode;
+  bool _commandFailed;
+  uint8_t _failedCmd;
+  uint32_t _rng;
+
+  bool StartTrack(FileStrategy fileStrategy, const char *request = "");
+  bool VgmVerify();
+  void PrepareChips();
+  void ReadGD3();
+  void DrawTrackInfo();
+  void HandleSerialIn();
+  bool RunLine();
+  void SeekTrack(uint32_t sample);
+  void SeekStep();
+  void SetVolume(uint8_t dB);
+  uint8_t TrackLevel(uint8_t addr, uint8_t data);
+  bool RefreshLevels();
+  void CacheLoop();
+  bool RefillFromCache();
+  void FillBuffer();
+  bool TopUpBuffer();
+  int CollectRead(bool wait);
+  void ClearBuffers();
+  void WaitForData(bool skipping = false);
+  uint8_t ReadBuffer();
+  void SkipBuffer(uint32_t count);
+  uint16_t ReadBuffer16();
+  uint32_t ReadBuffer32();
+  uint32_t ReadSD32();
+  bool PeekBuffer(uint8_t &next);
+  bool PeekVGM(uint8_t &next);
+  bool PeekOPM(uint8_t &next);
+  uint32_t VgmWait(uint8_t cmd);
+  uint32_t ParseVGM();
+  uint32_t ParseOPM();
+  void LoopTrack();
+  bool OpenStream();
+  void StartStream();
+  void StopStream(uint8_t error);
+  void PollStream();
+  void HandleFrame();
+  void SendFrame(uint8_t type, const uint8_t *payload, uint8_t length);
+  void QueueWrite(uint8_t addr, uint8_t data);
+  void ScheduleCommands();
+  static const char* TrimName(const char *name, size_t &len);
+  static uint32_t HashName(const char *name, size_t len);
+  void IndexName(uint16_t track, const char *name);
+  uint32_t FindTrack(const char *request);
+  uint16_t TrackEntry(uint32_t track);
+  uint32_t Random(uint32_t max);
+  void Printf(const char *format, ...);
+public:
+  Player(TrackStorage &storage, ChipBus &bus, SampleTimer &timer, Display &display, SerialPort &serial);
+  void Begin(void (*isr)()); //Index the card, start the sample timer on isr and play the first track. isr must call Tick()
+  void Loop();
+  void Tick();
+  bool ChangeTrack(FileStrategy fileStrategy, const char *request = ""); //Returns true if a new track started
+  static bool DecodeHeader(VGMHeader &header, const uint8_t *raw, uint32_t length);
+  void SetPlayMode(PlayMode mode);
+  PlayMode Mode() {return _playMode;}
+  uint16_t LoopCount() {return _loopCount;}
+  bool Streaming() {return _streaming;}
+  bool Seeking() {return _seeking;}
+  uint32_t SamplesQueued() {return _parseTime - _sampleClock;} //How far parsing is ahead of the sample clock
+  PlaybackStats &Stats() {return _stats;}
+};
+#endif
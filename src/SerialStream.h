@@ -0,0 +1,48 @@
+#ifndef SERIALSTREAM_H_
+#define SERIALSTREAM_H_
+//Binary streaming over the serial port, turning the board into a live YM2151 output for a host
+//(tools/opmstream). The host sends a precompiled OPM stream (see OPMStream.h) in frames and the player
+//schedules it exactly like a track read from the card.
+//
+//Frame: STREAM_SYNC, type, length, payload[length], check
+//check makes type + length + payload + check add up to 0 in 8 bits. Text the player prints while
+//streaming can still turn up between frames, so readers skip anything up to the next STREAM_SYNC.
+//Multi-byte values are little-endian.
+//
+//Host to board:
+//STREAM_OPEN  uint32 STREAM_MAGIC, uint8 STREAM_VERSION, uint32 YM2151 clock. The first frame. The player
+//             keeps on with what it was doing until a whole OPEN frame has arrived with a good check,
+//             magic and version, so a stray sync byte is only ever a dropped byte. The first
+//             STREAM_CREDIT is the answer. A version mismatch is answered with STREAM_ERR_VERSION
+//STREAM_DATA  OPM stream commands, whole commands only. OPM_END is not allowed, send STREAM_CLOSE
+//STREAM_CLOSE Play out what has been sent, then idle until a track is picked or the next stream starts
+//
+//Board to host:
+//STREAM_CREDIT uint16 payload bytes the host may send on top of what it was already granted.
+//              Sent after STREAM_OPEN and whenever the player frees up STREAM_CREDIT_STEP more
+//STREAM_DONE   Everything sent has been played, the stream is over
+//STREAM_ERROR  uint8 STREAM_ERR_* code. The stream has been dropped. That also happens when a track is
+//              picked with the buttons, or when everything sent has played and the host has been quiet
+//              for STREAM_IDLE_TIMEOUT_US since the last credit
+#define STREAM_SYNC 0xA5
+#define STREAM_MAX_PAYLOAD 60 //A whole frame fits one 64 byte USB packet
+#define STREAM_CREDIT_STEP 512 //Credit is handed back in steps of at least this much
+#define STREAM_MAGIC 0x534D504FUL //"OPMS"
+#define STREAM_VERSION 1
+#define STREAM_OPEN_SIZE 9 //Payload of STREAM_OPEN
+#define STREAM_IDLE_TIMEOUT_US 2000000 //Host silence, once the stream has played out, that ends it
+
+#define STREAM_OPEN 'O'
+#define STREAM_DATA 'D'
+#define STREAM_CLOSE 'C'
+#define STREAM_CREDIT 'K'
+#define STREAM_DONE 'E'
+#define STREAM_ERROR 'X'
+
+#define STREAM_ERR_CHECK 1 //Frame failed its check
+#define STREAM_ERR_CREDIT 2 //More data than was credited
+#define STREAM_ERR_FRAME 3 //Unknown or malformed frame
+#define STREAM_ERR_VERSION 4 //STREAM_OPEN from a host speaking another protocol version. No stream was started
+#define STREAM_ERR_TIMEOUT 5 //Host went quiet
+#define STREAM_ERR_STOPPED 6 //A track was picked on the board
+#endif
@@ -1,6 +1,11 @@
 #ifndef TRACKSTRUCTS_H_
 #define TRACKSTRUCTS_H_
 #include <stdint.h>
+#define VGM_IDENT 0x206D6756
+
+//GD3 text
+#define GD3_ARENA_SIZE 512 //Every GD3 field shares this, the last byte is kept as the empty string
+#define GD3_CHUNK_SIZE 64 //Bytes of UTF-16 read from the card at a time
 struct VGMHeader
 {
     uint32_t indent;
@@ -27,6 +32,7 @@ struct VGMHeader
     uint32_t ym3526clock;
     uint32_t y8950clock;
     uint32_t ymf262clock;
+    uint32_t ymf278bclock;
     uint32_t ymf271clock;
     uint32_t ymz280Bclock;
     uint32_t rf5C164clock;
@@ -80,6 +86,7 @@ struct VGMHeader
         ym3526clock = 0;
         y8950clock = 0;
         ymf262clock = 0;
+        ymf278bclock = 0;
         ymf271clock = 0;
         ymz280Bclock = 0;
         rf5C164clock = 0;
@@ -109,27 +116,78 @@ struct VGMHeader
     }
 };
 
+enum GD3Field {GD3_TRACK, GD3_TRACK_JP, GD3_GAME, GD3_GAME_JP, GD3_SYSTEM, GD3_SYSTEM_JP,
+    GD3_AUTHOR, GD3_AUTHOR_JP, GD3_DATE, GD3_CONVERTER, GD3_NOTES, GD3_FIELDS};
+
+//GD3 tag fields, transcoded from UTF-16 to UTF-8 into one fixed arena in file order.
+//Each field is cut at a character boundary once it reaches its limit: 63 bytes for the English names,
+//31 for the Japanese names and the converter and 15 for the date. The notes get whatever is left.
+//Fields past the end of the arena, or missing from the tag, read as empty strings
 struct GD3
 {
     uint32_t size;
-    String enTrackName;
-    String enGameName;
-    String enSystemName;
-    String enAuthor;
-    String releaseDate;
+    char text[GD3_ARENA_SIZE];
+    uint16_t start[GD3_FIELDS]; //Offset of each field in text
+    uint16_t used;
+    uint8_t field; //Field being filled
+
     void Reset()
     {
         size = 0;
-        enTrackName = "";
-        enGameName = "";
-        enSystemName = "";
-        enAuthor = "";
-        releaseDate = "";
+        used = 0;
+        field = 0;
+        for(uint8_t i = 0; i<GD3_FIELDS; i++)
+            start[i] = GD3_ARENA_SIZE - 1;
+        start[0] = 0;
+        text[0] = 0;
+        text[GD3_ARENA_SIZE - 1] = 0;
     }
+
+    static uint16_t Limit(uint8_t f)
+    {
+        if(f == GD3_NOTES)
+            return GD3_ARENA_SIZE;
+        if(f == GD3_DATE)
+            return 15;
+        if(f == GD3_CONVERTER || (f & 1))
+            return 31;
+        return 63;
+    }
+
+    //Add one character to the field being filled. Characters that don't fit are dropped
+    void Append(uint32_t c)
+    {
+        if(field >= GD3_FIELDS)
+            return;
+        uint8_t n = c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+        if(used + n > GD3_ARENA_SIZE - 2 || used + n - start[field] > Limit(field))
+            return;
+        char *out = text + used;
+        if(n == 1)
+            out[0] = c;
+        else
+        {
+            for(uint8_t i = n-1; i>0; i--, c >>= 6)
+                out[i] = 0x80 | (c & 0x3F);
+            out[0] = char((0xF00 >> n) | c); //Lead byte: n high bits set, then the rest of c
+        }
+        used += n;
+    }
+
+    //Terminate the field being filled and move on to the next
+    void EndField()
+    {
+        if(field >= GD3_FIELDS)
+            return;
+        if(start[field] < GD3_ARENA_SIZE - 1)
+            text[used++] = 0;
+        if(++field < GD3_FIELDS)
+            start[field] = used < GD3_ARENA_SIZE - 1 ? used : GD3_ARENA_SIZE - 1;
+    }
+
+    const char *Text(GD3Field f) const {return text + start[f];}
 };
 
 enum FileStrategy {FIRST_START, NEXT, PREV, RND, REQUEST};
 enum PlayMode {LOOP, PAUSE, SHUFFLE, IN_ORDER};
-static VGMHeader header;
-static GD3 gd3;
 #endif
\ No newline at end of file
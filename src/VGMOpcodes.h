@@ -0,0 +1,63 @@
+#ifndef VGMOPCODES_H_
+#define VGMOPCODES_H_
+#include <stdint.h>
+//Every VGM 1.71 command, indexed by its opcode. Shared by the player and tools/vgm2opm.
+//
+//Each entry packs how the command is handled (high nibble) with the number of operand bytes
+//that follow the opcode (low nibble). Commands for chips the player doesn't drive, including the
+//reserved ranges the spec gives a length for, are VGM_SKIP and get dropped by their exact length.
+//Only opcodes the spec leaves undefined are VGM_UNKNOWN, after one of those the stream can't be followed
+#define VGM_SKIP 0x0 //Operands are dropped
+#define VGM_WRITE 0x1 //aa dd, first YM2151
+#define VGM_WAIT 0x2 //nn nn samples
+#define VGM_WAIT_NTSC 0x3 //735 samples
+#define VGM_WAIT_PAL 0x4 //882 samples
+#define VGM_WAIT_SHORT 0x5 //Low nibble + 1 samples
+#define VGM_WAIT_DAC 0x6 //YM2612 DAC write, then low nibble samples
+#define VGM_DATA_BLOCK 0x7 //66 tt ss ss ss ss, then ss ss ss ss bytes of data. Bit 31 of the size marks the second chip
+#define VGM_END 0x8 //End of sound data, continue from the loop offset
+#define VGM_UNKNOWN 0xF
+
+#define VGM_OP(kind, length) (((kind) << 4) | (length))
+#define VGM_OP_KIND(op) ((op) >> 4)
+#define VGM_OP_LENGTH(op) ((op) & 0x0F)
+
+#define VGM_OP_ROW(op) op, op, op, op, op, op, op, op, op, op, op, op, op, op, op, op
+#define VGM_OP_UNKNOWN VGM_OP(VGM_UNKNOWN, 0)
+
+static const uint8_t vgmOpcodes[256] =
+{
+  VGM_OP_ROW(VGM_OP_UNKNOWN), //0x00
+  VGM_OP_ROW(VGM_OP_UNKNOWN), //0x10
+  VGM_OP_ROW(VGM_OP_UNKNOWN), //0x20
+  VGM_OP_ROW(VGM_OP(VGM_SKIP, 1)), //0x30 Second SN76489 and reserved
+  //0x40 Mikey and reserved, 0x4F Game Gear stereo
+  VGM_OP(VGM_SKIP, 2), VGM_OP(VGM_SKIP, 2), VGM_OP(VGM_SKIP, 2), VGM_OP(VGM_SKIP, 2),
+  VGM_OP(VGM_SKIP, 2), VGM_OP(VGM_SKIP, 2), VGM_OP(VGM_SKIP, 2), VGM_OP(VGM_SKIP, 2),
+  VGM_OP(VGM_SKIP, 2), VGM_OP(VGM_SKIP, 2), VGM_OP(VGM_SKIP, 2), VGM_OP(VGM_SKIP, 2),
+  VGM_OP(VGM_SKIP, 2), VGM_OP(VGM_SKIP, 2), VGM_OP(VGM_SKIP, 2), VGM_OP(VGM_SKIP, 1),
+  //0x50 SN76489, 0x51-0x5F Yamaha FM chips. 0x54 is the YM2151
+  VGM_OP(VGM_SKIP, 1), VGM_OP(VGM_SKIP, 2), VGM_OP(VGM_SKIP, 2), VGM_OP(VGM_SKIP, 2),
+  VGM_OP(VGM_WRITE, 2), VGM_OP(VGM_SKIP, 2), VGM_OP(VGM_SKIP, 2), VGM_OP(VGM_SKIP, 2),
+  VGM_OP(VGM_SKIP, 2), VGM_OP(VGM_SKIP, 2), VGM_OP(VGM_SKIP, 2), VGM_OP(VGM_SKIP, 2),
+  VGM_OP(VGM_SKIP, 2), VGM_OP(VGM_SKIP, 2), VGM_OP(VGM_SKIP, 2), VGM_OP(VGM_SKIP, 2),
+  //0x60 Waits, end of data, data blocks and 0x68 PCM RAM writes
+  VGM_OP_UNKNOWN, VGM_OP(VGM_WAIT, 2), VGM_OP(VGM_WAIT_NTSC, 0), VGM_OP(VGM_WAIT_PAL, 0),
+  VGM_OP_UNKNOWN, VGM_OP_UNKNOWN, VGM_OP(VGM_END, 0), VGM_OP(VGM_DATA_BLOCK, 6),
+  VGM_OP(VGM_SKIP, 11), VGM_OP_UNKNOWN, VGM_OP_UNKNOWN, VGM_OP_UNKNOWN,
+  VGM_OP_UNKNOWN, VGM_OP_UNKNOWN, VGM_OP_UNKNOWN, VGM_OP_UNKNOWN,
+  VGM_OP_ROW(VGM_OP(VGM_WAIT_SHORT, 0)), //0x70
+  VGM_OP_ROW(VGM_OP(VGM_WAIT_DAC, 0)), //0x80
+  //0x90 DAC stream control
+  VGM_OP(VGM_SKIP, 4), VGM_OP(VGM_SKIP, 4), VGM_OP(VGM_SKIP, 5), VGM_OP(VGM_SKIP, 10),
+  VGM_OP(VGM_SKIP, 1), VGM_OP(VGM_SKIP, 4), VGM_OP_UNKNOWN, VGM_OP_UNKNOWN,
+  VGM_OP_UNKNOWN, VGM_OP_UNKNOWN, VGM_OP_UNKNOWN, VGM_OP_UNKNOWN,
+  VGM_OP_UNKNOWN, VGM_OP_UNKNOWN, VGM_OP_UNKNOWN, VGM_OP_UNKNOWN,
+  VGM_OP_ROW(VGM_OP(VGM_SKIP, 2)), //0xA0 AY8910 and second chips
+  VGM_OP_ROW(VGM_OP(VGM_SKIP, 2)), //0xB0
+  VGM_OP_ROW(VGM_OP(VGM_SKIP, 3)), //0xC0
+  VGM_OP_ROW(VGM_OP(VGM_SKIP, 3)), //0xD0
+  VGM_OP_ROW(VGM_OP(VGM_SKIP, 4)), //0xE0
+  VGM_OP_ROW(VGM_OP(VGM_SKIP, 4)), //0xF0
+};
+#endif
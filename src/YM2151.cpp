@@ -1,5 +1,6 @@
 #include "YM2151.h"
 #include <Arduino.h>
+#include "CycleCounter.h"
 YM2151::YM2151(int * dataPins, int CS, int RD, int WR, int A0, int IRQ, int IC)
 {
     disableDebugPorts();
@@ -30,25 +31,155 @@ YM2151::YM2151(int * dataPins, int CS, int RD, int WR, int A0, int IRQ, int IC)
     if(_IRQ != NULL)
         digitalWrite(_IRQ, LOW);
     digitalWrite(_IC, HIGH);
+#if YM_FAST_BUS
+    SetClock(YM_DEFAULT_CLOCK);
+    BuildBusMasks();
+#endif
+#if YM_SHADOW_REGS
+    InvalidateShadow();
+#endif
 }
 
+#if YM_SHADOW_REGS
+//Forget every cached register value and restart the per track counters
+void YM2151::InvalidateShadow()
+{
+    memset(_shadowValid, 0, sizeof(_shadowValid));
+    _totalWrites = 0;
+    _elidedWrites = 0;
+}
+#endif
+
+#if YM_FAST_BUS
+//Group the data pins by GPIO port and precompute, per nibble value, which port bits it sets,
+//so a whole byte goes out with a single BSRR store per port
+void YM2151::BuildBusMasks()
+{
+    _portCount = 0;
+    memset(_ports, 0, sizeof(_ports));
+    for(int i = 0; i<8; i++)
+    {
+        int pin = *(_dataPins+i);
+        volatile uint32_t * bsrr = &PIN_MAP[pin].gpio_device->regs->BSRR;
+        uint16_t bit = 1 << PIN_MAP[pin].gpio_bit;
+        uint8_t p = 0;
+        while(p < _portCount && _ports[p].bsrr != bsrr)
+            p++;
+        if(p == _portCount)
+        {
+            if(_portCount == YM_MAX_BUS_PORTS)
+                continue;
+            _ports[_portCount++].bsrr = bsrr;
+        }
+        BusPort * port = &_ports[p];
+        port->mask |= bit;
+        for(int n = 0; n<16; n++)
+        {
+            if(i < 4 && ((n >> i)&1))
+                port->lo[n] |= bit;
+            if(i >= 4 && ((n >> (i-4))&1))
+                port->hi[n] |= bit;
+        }
+    }
+    _csBsrr = &PIN_MAP[_CS].gpio_device->regs->BSRR;
+    _csBit = 1 << PIN_MAP[_CS].gpio_bit;
+    _wrBsrr = &PIN_MAP[_WR].gpio_device->regs->BSRR;
+    _wrBit = 1 << PIN_MAP[_WR].gpio_bit;
+    _a0Bsrr = &PIN_MAP[_A0].gpio_device->regs->BSRR;
+    _a0Bit = 1 << PIN_MAP[_A0].gpio_bit;
+
+    cycleCounterBegin(); //Spaces writes by the chip's busy period
+    _lastWrite = cycleCount() - _busyCycles;
+}
+
+static inline void CSPulseDelay()
+{
+    for(int i = 0; i<YM_CS_PULSE_NOPS; i++)
+        __asm__ __volatile__("nop");
+}
+#endif
+
 void YM2151::Reset()
 {
     digitalWrite(_IC, LOW);
     delayMicroseconds(25);
     digitalWrite(_IC, HIGH);
+#if YM_SHADOW_REGS
+    InvalidateShadow();
+#endif
+}
+
+//The busy period is a fixed number of master clocks, so it gets longer as the clock slows down.
+//Rounded up, a write is never let through early
+void YM2151::SetClock(uint32_t hz)
+{
+#if YM_FAST_BUS
+    if(hz == 0)
+        hz = YM_DEFAULT_CLOCK;
+    _busyCycles = ((uint64_t)YM_BUSY_CLOCKS * CYCLE_TICKS_PER_US * 1000000 + hz - 1) / hz;
+#endif
+}
+
+//True while the chip is still inside the busy period of the last data write
+bool YM2151::Busy()
+{
+#if YM_FAST_BUS
+    return cycleCount() - _lastWrite < _busyCycles;
+#else
+    return false;
+#endif
 }
 
 void YM2151::WriteDataPins(unsigned char data) //Digital I/O
 {
+#if YM_FAST_BUS
+    for(uint8_t p = 0; p<_portCount; p++)
+    {
+        const BusPort * port = &_ports[p];
+        uint32_t set = port->lo[data & 0x0F] | port->hi[data >> 4];
+        *port->bsrr = set | (uint32_t(port->mask & ~set) << 16); //Set and reset in one store
+    }
+#else
     for(int i=0; i<8; i++)
     {
       digitalWrite(*(_dataPins+i), ((data >> i)&1));
     }
+#endif
 }
 
 void YM2151::SendDataPins(unsigned char addr, unsigned char data)
 {
+#if YM_SHADOW_REGS
+        _totalWrites++;
+        //0x01 (test/LFO reset), 0x08 (key on/off) and 0x14 (timer control) act on every write
+        if(addr != 0x01 && addr != 0x08 && addr != 0x14)
+        {
+            uint8_t validBit = 1 << (addr & 7);
+            if((_shadowValid[addr >> 3] & validBit) && _shadow[addr] == data)
+            {
+                _elidedWrites++;
+                return;
+            }
+            _shadow[addr] = data;
+            _shadowValid[addr >> 3] |= validBit;
+        }
+#endif
+#if YM_FAST_BUS
+        while(Busy()){}
+        PinLow(_wrBsrr, _wrBit);
+        PinLow(_a0Bsrr, _a0Bit);
+        WriteDataPins(addr);
+        PinLow(_csBsrr, _csBit);
+        CSPulseDelay();
+        PinHigh(_csBsrr, _csBit);
+        PinHigh(_a0Bsrr, _a0Bit);
+        WriteDataPins(data);
+        PinLow(_csBsrr, _csBit);
+        CSPulseDelay();
+        PinHigh(_csBsrr, _csBit);
+        PinHigh(_wrBsrr, _wrBit);
+        _lastWrite = cycleCount();
+#else
         digitalWrite(_WR, LOW);
         digitalWrite(_A0, LOW);
         WriteDataPins(addr);
@@ -62,4 +193,5 @@ void YM2151::SendDataPins(unsigned char addr, unsigned char data)
         delayMicroseconds(1); //Replace with 10 nS delay?
         digitalWrite(_CS, HIGH);
         digitalWrite(_WR, HIGH);
+#endif
 }
\ No newline at end of file
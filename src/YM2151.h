@@ -1,6 +1,12 @@
 #ifndef YM2151_H_
 #define YM2151_H_
 #include <Arduino.h>
+#define YM_FAST_BUS true //Drive the bus with direct BSRR port stores. Set to false to fall back to digitalWrite
+#define YM_MAX_BUS_PORTS 4 //GPIOA-GPIOD on the Blue Pill
+#define YM_CS_PULSE_NOPS 12 //~170 nS @72MHz, comfortably above the YM2151's minimum write pulse width
+#define YM_SHADOW_REGS true //Skip writes that would not change the chip's register file
+#define YM_BUSY_CLOCKS 64 //Master clocks the chip stays busy after a data write. Writes during the busy period are ignored
+#define YM_DEFAULT_CLOCK 3579545 //Master clock assumed until SetClock() is called
 class YM2151
 {
 private:
@@ -12,9 +18,44 @@ private:
     int _IRQ;
     int _IC;
     void WriteDataPins(unsigned char data);
+#if YM_SHADOW_REGS
+    uint8_t _shadow[256]; //Last value written to each register
+    uint8_t _shadowValid[32]; //One bit per register, set once _shadow holds a known value
+    uint32_t _totalWrites;
+    uint32_t _elidedWrites;
+    void InvalidateShadow();
+#endif
+#if YM_FAST_BUS
+    struct BusPort
+    {
+        volatile uint32_t * bsrr;
+        uint16_t mask; //Every data pin on this port
+        uint16_t lo[16]; //Port bits set by each low nibble of a data byte
+        uint16_t hi[16]; //Port bits set by each high nibble of a data byte
+    };
+    BusPort _ports[YM_MAX_BUS_PORTS];
+    uint8_t _portCount;
+    volatile uint32_t * _csBsrr;
+    volatile uint32_t * _wrBsrr;
+    volatile uint32_t * _a0Bsrr;
+    uint32_t _csBit;
+    uint32_t _wrBit;
+    uint32_t _a0Bit;
+    uint32_t _lastWrite; //Cycle count at the end of the previous data write
+    uint32_t _busyCycles; //YM_BUSY_CLOCKS in cycle counter ticks at the current master clock
+    void BuildBusMasks();
+    inline void PinHigh(volatile uint32_t * bsrr, uint32_t bit) {*bsrr = bit;}
+    inline void PinLow(volatile uint32_t * bsrr, uint32_t bit) {*bsrr = bit << 16;}
+#endif
 public:
     YM2151(int * dataPins, int CS, int RD, int WR, int A0, int IRQ, int IC);
     void Reset();
+    void SetClock(uint32_t hz); //Master clock the chip now runs at, which sets the length of the busy period
     void SendDataPins(unsigned char addr, unsigned char data);
+    bool Busy();
+#if YM_SHADOW_REGS
+    uint32_t TotalWrites() {return _totalWrites;}
+    uint32_t ElidedWrites() {return _elidedWrites;}
+#endif
 };
 #endif
\ No newline at end of file
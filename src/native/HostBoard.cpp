@@ -0,0 +1,284 @@
+#include "HostBoard.h"
+#include <algorithm>
+#include <dirent.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+DirStorage::DirStorage(const char *root)
+{
+  _root = root;
+  _timer = NULL;
+  _blockSamples = 0;
+  _lastBlock = 0xFFFFFFFF;
+  _async = false;
+  _readState = READ_IDLE;
+  _readDst = NULL;
+  _readCount = 0;
+  _readDue = 0;
+  _readResult = 0;
+  _next = 0;
+  _file = NULL;
+  _open = 0;
+  _size = 0;
+}
+
+DirStorage::~DirStorage()
+{
+  if(_file)
+    fclose(_file);
+}
+
+bool DirStorage::Begin()
+{
+  DIR *dir = opendir(_root.c_str());
+  if(!dir)
+    return false;
+  while(struct dirent *entry = readdir(dir))
+  {
+    struct stat st;
+    if(entry->d_name[0] == '.')
+      continue;
+    if(stat((_root + "/" + entry->d_name).c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+      continue;
+    _names.push_back(entry->d_name);
+  }
+  closedir(dir);
+  std::sort(_names.begin(), _names.end());
+  if(_names.size() > 0xFFFF)
+    _names.resize(0xFFFF);
+  _next = 0;
+  return true;
+}
+
+bool DirStorage::NextEntry(uint16_t &dirIndex, char *name, size_t size)
+{
+  if(_next >= _names.size())
+    return false;
+  dirIndex = _next++;
+  return EntryName(dirIndex, name, size);
+}
+
+bool DirStorage::EntryName(uint16_t dirIndex, char *name, size_t size)
+{
+  if(dirIndex >= _names.size() || size == 0)
+    return false;
+  snprintf(name, size, "%s", _names[dirIndex].c_str());
+  return true;
+}
+
+bool DirStorage::Open(uint16_t dirIndex)
+{
+  WaitRead();
+  _readState = READ_IDLE; //An uncollected read belonged to the previous track
+  if(_file)
+    fclose(_file);
+  _file = NULL;
+  if(dirIndex >= _names.size())
+    return false;
+  _lastBlock = 0xFFFFFFFF;
+  _file = fopen((_root + "/" + _names[dirIndex]).c_str(), "rb");
+  _open = dirIndex;
+  if(!_file)
+    return false;
+  fseek(_file, 0, SEEK_END);
+  _size = ftell(_file);
+  rewind(_file);
+  return true;
+}
+
+void DirStorage::Name(char *name, size_t size)
+{
+  if(!_file || !EntryName(_open, name, size))
+    name[0] = 0;
+}
+
+//Ticks a read of count bytes from the current position takes. Like SdFat's block cache,
+//rereading the block of the previous read is free
+uint32_t DirStorage::ReadCost(uint32_t count)
+{
+  if(!_timer || count == 0)
+    return 0;
+  uint32_t pos = Position();
+  uint32_t first = pos / 512;
+  uint32_t last = (pos + count - 1) / 512;
+  uint32_t cost = _blockSamples * (last - first + (first != _lastBlock));
+  _lastBlock = last;
+  return cost;
+}
+
+//Let the background read run to completion. Its result is kept for PollRead()
+void DirStorage::WaitRead()
+{
+  if(_readState != READ_BUSY)
+    return;
+  if(_timer && int32_t(_readDue - _timer->Now()) > 0)
+    _timer->Run(_readDue - _timer->Now());
+  _readResult = fread(_readDst, 1, _readCount, _file);
+  _readState = READ_DONE;
+}
+
+int DirStorage::Read(void *dst, uint32_t count)
+{
+  WaitRead();
+  if(!_file)
+    return -1;
+  uint32_t cost = ReadCost(count);
+  if(cost)
+    _timer->Run(cost);
+  return fread(dst, 1, count, _file);
+}
+
+//Like SdStorage, one whole block from a block boundary. Anything else is left to Read()
+bool DirStorage::BeginRead(void *dst, uint32_t count)
+{
+  if(!_async || !_file || _readState != READ_IDLE || count < 512 || (Position() & 511) || Available() < 512)
+    return false;
+  _readDue = (_timer ? _timer->Now() : 0) + ReadCost(512);
+  _readDst = dst;
+  _readCount = 512;
+  _readState = READ_BUSY;
+  return true;
+}
+
+int DirStorage::PollRead()
+{
+  if(_readState == READ_IDLE)
+    return -1;
+  if(_readState == READ_BUSY)
+  {
+    if(_timer && int32_t(_readDue - _timer->Now()) > 0)
+    {
+      _timer->Run(1); //Polling takes time on the board too, so a caller spinning here still sees the read finish
+      return 0;
+    }
+    WaitRead();
+  }
+  _readState = READ_IDLE;
+  return _readResult > 0 ? _readResult : -1;
+}
+
+bool DirStorage::Seek(uint32_t pos)
+{
+  WaitRead();
+  if(_timer)
+    _timer->Run(_blockSamples);
+  return _file && fseek(_file, pos, SEEK_SET) == 0;
+}
+
+uint32_t DirStorage::Position()
+{
+  return _file ? ftell(_file) : 0;
+}
+
+uint32_t DirStorage::Available()
+{
+  uint32_t pos = Position();
+  return _file && _size > pos ? _size - pos : 0;
+}
+
+void HostTimer::Run(uint32_t samples)
+{
+  for(uint32_t i = 0; i<samples; i++)
+  {
+    _now++;
+    if(_isr)
+      _isr();
+  }
+}
+
+RecordingBus::RecordingBus(const HostTimer &timer, FILE *log) : _timer(timer), _log(log)
+{
+  _clock = 0;
+  _writes = 0;
+  _resets = 0;
+  _checksum = 2166136261UL;
+}
+
+void RecordingBus::Reset()
+{
+  _resets++;
+  if(_log)
+    fprintf(_log, "%lu,reset\n", (unsigned long)_timer.Now());
+}
+
+void RecordingBus::Write(uint8_t addr, uint8_t data)
+{
+  uint32_t now = _timer.Now();
+  uint8_t bytes[6] = {uint8_t(now), uint8_t(now >> 8), uint8_t(now >> 16), uint8_t(now >> 24), addr, data};
+  for(int i = 0; i<6; i++)
+  {
+    _checksum ^= bytes[i];
+    _checksum *= 16777619UL;
+  }
+  _writes++;
+  if(_log)
+    fprintf(_log, "%lu,%02X,%02X\n", (unsigned long)now, addr, data);
+}
+
+void RecordingBus::Dump(SerialPort &out)
+{
+  char line[40];
+  snprintf(line, sizeof(line), "bus_clock_hz,%lu", (unsigned long)_clock);
+  out.PrintLine(line);
+  snprintf(line, sizeof(line), "bus_resets,%lu", (unsigned long)_resets);
+  out.PrintLine(line);
+  snprintf(line, sizeof(line), "bus_writes,%lu", (unsigned long)_writes);
+  out.PrintLine(line);
+  snprintf(line, sizeof(line), "bus_checksum,%08lX", (unsigned long)_checksum);
+  out.PrintLine(line);
+}
+
+void HostDisplay::ShowMessage(const char *top, const char *bottom)
+{
+  printf("[OLED] %s / %s\n", top, bottom);
+}
+
+void HostDisplay::ShowTrack(const char *track, const char *game, PlayMode mode)
+{
+  printf("[OLED] %s / %s / %s\n", track, game, mode == LOOP ? "LOOP" : mode == SHUFFLE ? "SHUFFLE" : "IN ORDER");
+}
+
+int HostSerial::Available()
+{
+  if(_inPos == _inEnd && _fd >= 0)
+  {
+    ssize_t got = read(_fd, _in, sizeof(_in));
+    _inPos = 0;
+    _inEnd = got > 0 ? got : 0;
+  }
+  return _inEnd - _inPos;
+}
+
+int HostSerial::Read()
+{
+  return Available() ? _in[_inPos++] : -1;
+}
+
+void HostSerial::Print(const char *text)
+{
+  Write((const uint8_t *)text, strlen(text));
+}
+
+void HostSerial::PrintLine(const char *line)
+{
+  Print(line);
+  Print(_fd >= 0 ? "\r\n" : "\n"); //Serial.println() ends lines with CRLF
+}
+
+void HostSerial::Write(const uint8_t *data, size_t size)
+{
+  if(_fd < 0)
+  {
+    fwrite(data, 1, size, stdout);
+    return;
+  }
+  while(size > 0)
+  {
+    ssize_t put = write(_fd, data, size);
+    if(put <= 0)
+      return;
+    data += put;
+    size -= put;
+  }
+}
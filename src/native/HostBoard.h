@@ -0,0 +1,115 @@
+#ifndef HOSTBOARD_H_
+#define HOSTBOARD_H_
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "../Hal.h"
+//Workstation stand-ins for the Hal.h interfaces, used by env:native
+
+class HostTimer;
+
+//A directory holding the card's files. Entries are listed in name order and their dirIndex is their
+//position in that list. Dot files are skipped, as SdStorage::RemoveMeta() deletes them on the card.
+//SetLatency() simulates a slow card by firing ticks while each block is read or a seek is made,
+//the way the tick ISR preempts a real SD transfer. With background reads enabled BeginRead() takes one
+//block under the same conditions as SdStorage and fires nothing. The read completes once the same
+//number of ticks has gone by and only then is dst written, so a caller that looks at the data early or
+//loses track of a read sees stale bytes. Each PollRead() that finds the read still running fires one tick
+class DirStorage : public TrackStorage
+{
+private:
+    enum ReadState {READ_IDLE, READ_BUSY, READ_DONE};
+    HostTimer *_timer;
+    uint32_t _blockSamples;
+    uint32_t _lastBlock;
+    bool _async;
+    ReadState _readState;
+    void *_readDst;
+    uint32_t _readCount;
+    uint32_t _readDue; //Tick the background read completes on
+    int _readResult;
+    uint32_t ReadCost(uint32_t count);
+    void WaitRead();
+    std::string _root;
+    std::vector<std::string> _names;
+    size_t _next;
+    FILE *_file;
+    uint16_t _open;
+    uint32_t _size;
+public:
+    DirStorage(const char *root);
+    ~DirStorage();
+    bool Begin();
+    void SetLatency(HostTimer *timer, uint32_t blockSamples, bool async) {_timer = timer; _blockSamples = blockSamples; _async = async;}
+    void Rewind() {_next = 0;}
+    bool NextEntry(uint16_t &dirIndex, char *name, size_t size);
+    bool EntryName(uint16_t dirIndex, char *name, size_t size);
+    bool Open(uint16_t dirIndex);
+    void Name(char *name, size_t size);
+    int Read(void *dst, uint32_t count);
+    bool Seek(uint32_t pos);
+    uint32_t Position();
+    uint32_t Available();
+    bool BeginRead(void *dst, uint32_t count);
+    int PollRead();
+};
+
+//Fires the tick ISR on demand instead of in real time. Now() is the number of ticks fired so far
+class HostTimer : public SampleTimer
+{
+private:
+    void (*_isr)();
+    uint32_t _now;
+public:
+    HostTimer() : _isr(NULL), _now(0) {}
+    void Begin(void (*isr)()) {_isr = isr;}
+    void Run(uint32_t samples);
+    uint32_t Now() const {return _now;}
+};
+
+//Records every register write with the sample it was sent on. The log is "sample,addr,data" CSV,
+//the FNV-1a checksum of the same triples gives a one line fingerprint for regression runs
+class RecordingBus : public ChipBus
+{
+private:
+    const HostTimer &_timer;
+    FILE *_log;
+    uint32_t _clock;
+    uint32_t _writes;
+    uint32_t _resets;
+    uint32_t _checksum;
+public:
+    RecordingBus(const HostTimer &timer, FILE *log);
+    void Reset();
+    void SetClock(uint32_t hz) {_clock = hz;}
+    void Write(uint8_t addr, uint8_t data);
+    bool Busy() {return false;}
+    void Dump(SerialPort &out);
+};
+
+class HostDisplay : public Display
+{
+public:
+    void Begin() {}
+    void ShowMessage(const char *top, const char *bottom);
+    void ShowTrack(const char *track, const char *game, PlayMode mode);
+};
+
+//Output goes to stdout and there is no input, unless a file descriptor is given. Then both go through
+//it without blocking, such as the master side of a pseudo terminal standing in for the USB port
+class HostSerial : public SerialPort
+{
+private:
+    int _fd;
+    uint8_t _in[256];
+    size_t _inPos;
+    size_t _inEnd;
+public:
+    HostSerial(int fd = -1) : _fd(fd), _inPos(0), _inEnd(0) {}
+    int Available();
+    int Read();
+    void Print(const char *text);
+    void PrintLine(const char *line);
+    void Write(const uint8_t *data, size_t size);
+};
+#endif
@@ -0,0 +1,162 @@
+//Host build of the player core (pio run -e native)
+//
+//Usage: program [-n loops] [-s seconds] [-d samples] [-a] [-w write log] [-p] <card dir> <track>
+//
+//Plays one track from a directory standing in for the SD card, as fast as the core can parse it rather than
+//in real time. Stops once the track has looped [loops] times (default 1) or after [seconds] of music
+//(default 600), then prints the playback stats and the recording bus counters as "metric,value" CSV.
+//commands_per_s and dispatches_per_s give the parser load of the track before and after coalescing.
+//-d simulates a slow card, firing that many ticks per block read or seek.
+//-a makes refills background reads, which complete after the same delay without holding up the parser.
+//-w receives every register write.
+//-p serves the player's serial port on a pseudo terminal and prints its name to stderr. Nothing plays until
+//a host streams to it (tools/opmstream), then the run covers that one stream instead of the track.
+#ifndef UNIT_TEST //The test suites under test/ bring their own main()
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "HostBoard.h"
+#include "../Player.h"
+
+static Player *player;
+
+static void tick()
+{
+  player->Tick();
+}
+
+static double seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t loops = 1;
+  uint32_t limit = 600 * 44100;
+  uint32_t latency = 0;
+  bool async = false;
+  FILE *log = NULL;
+  bool pty = false;
+  int opt;
+  while((opt = getopt(argc, argv, "n:s:d:aw:p")) != -1)
+  {
+    switch(opt)
+    {
+      case 'n':
+        loops = atoi(optarg);
+      break;
+      case 's':
+        limit = atoi(optarg) * 44100;
+      break;
+      case 'd':
+        latency = atoi(optarg);
+      break;
+      case 'a':
+        async = true;
+      break;
+      case 'w':
+        if(!(log = fopen(optarg, "w")))
+        {
+          fprintf(stderr, "Can't write %s\n", optarg);
+          return 1;
+        }
+      break;
+      case 'p':
+        pty = true;
+      break;
+      default:
+        optind = argc;
+    }
+  }
+  if(argc - optind != 2)
+  {
+    fprintf(stderr, "Usage: %s [-n loops] [-s seconds] [-d samples] [-a] [-w write log] [-p] <card dir> <track>\n", argv[0]);
+    return 1;
+  }
+  DirStorage storage(argv[optind]);
+  if(!storage.Begin())
+  {
+    fprintf(stderr, "Can't open %s\n", argv[optind]);
+    return 1;
+  }
+
+  //The slave side stays open so the terminal keeps its raw settings between host tool runs
+  int master = -1;
+  if(pty)
+  {
+    struct termios raw;
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if(master < 0 || grantpt(master) || unlockpt(master) || open(ptsname(master), O_RDWR | O_NOCTTY) < 0)
+    {
+      fprintf(stderr, "Can't open a pseudo terminal\n");
+      return 1;
+    }
+    tcgetattr(master, &raw);
+    cfmakeraw(&raw);
+    tcsetattr(master, TCSANOW, &raw);
+    fcntl(master, F_SETFL, O_NONBLOCK);
+    fprintf(stderr, "pty,%s\n", ptsname(master));
+  }
+
+  HostTimer timer;
+  RecordingBus bus(timer, log);
+  HostDisplay display;
+  HostSerial serial(master);
+  HostSerial out;
+  static Player core(storage, bus, timer, display, serial);
+  player = &core;
+  core.Begin(tick);
+  if(!core.ChangeTrack(REQUEST, argv[optind+1]))
+    return 1;
+  core.SetPlayMode(LOOP);
+  storage.SetLatency(&timer, latency, async);
+
+  //Let the sample clock run up to half the schedule-ahead window behind the parser, so the queue keeps
+  //a lead the way it does on target, where loop() spins far faster than the tick
+  double start = seconds();
+  uint32_t first = timer.Now();
+  bool streamed = false;
+  while(timer.Now() - first < limit && (pty ? !streamed || core.Streaming() : core.LoopCount() < loops))
+  {
+    core.Loop();
+    if(pty && !streamed)
+    {
+      //Hold the clock until the stream starts, then time the run from there
+      streamed = core.Streaming();
+      if(!streamed)
+      {
+        usleep(1000);
+        continue;
+      }
+      start = seconds();
+      first = timer.Now();
+    }
+    int32_t ahead = core.SamplesQueued(); //Signed, the clock can end a tick or two past the parser
+    if(pty && ahead <= 0)
+      usleep(100); //Starved, give the host tool a chance to send more
+    timer.Run(ahead > SCHEDULE_AHEAD/2 ? ahead - SCHEDULE_AHEAD/2 : 1);
+  }
+  double elapsed = seconds() - start;
+  uint32_t played = timer.Now() - first;
+
+  core.Stats().Dump(out);
+  printf("loops,%u\n", core.LoopCount());
+  printf("samples,%lu\n", (unsigned long)played);
+  printf("host_us,%lu\n", (unsigned long)(elapsed * 1e6));
+  printf("realtime_factor,%lu\n", (unsigned long)(elapsed > 0 ? played / 44100.0 / elapsed : 0));
+  //Parser work the track needs per second of music, one dispatch per command against one per coalesced run
+  double music = played / 44100.0;
+  printf("commands_per_s,%lu\n", (unsigned long)(music > 0 ? core.Stats().Commands() / music : 0));
+  printf("dispatches_per_s,%lu\n", (unsigned long)(music > 0 ? core.Stats().Parses() / music : 0));
+  bus.Dump(out);
+  if(log)
+    fclose(log);
+  return 0;
+}
+#endif
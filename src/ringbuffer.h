@@ -4,7 +4,8 @@
    Desc: This template class creates a ringbuffer with arbitrary types. Provides push
          and pop methods for adding and removing items.  Access function for checking
          the number of items in the buffer, capacity and full or empty methods
-         provide safe access to the info.
+         provide safe access to the info. write_span/read_span hand out the contiguous
+         regions up to the wrap point so bulk copies can commit many items at once.
 
          This version has been optimized for the msp430-gcc and stm32. It doesn't use disable
          or enable any interrupts. It is safe nonetheless for use when there is a single
@@ -61,9 +62,11 @@ union uint16x2_t {
   // access as 32 bit
   unsigned long both;
   // -- or as 2 16 bit values --
+  // plain halfwords rather than bitfields, so the writer storing head and the
+  // reader storing tail never read-modify-write each other's half
   struct {
-    unsigned head: 16;
-    unsigned tail: 16;
+    uint16_t head;
+    uint16_t tail;
   };
 };
 
@@ -172,6 +175,58 @@ struct ringbuffer_t {
     return elem;
   }
 
+  /*
+      write_span() - returns the contiguous free region starting at head (up to the
+                     wrap point or the slot before tail) and its length in count.
+                     Fill it in place, then publish with commit_write().
+
+      Note: writer side only, reads tail
+  */
+  T* write_span(size_t &count) {
+    register uint16x2_t temp = { offsets.both };
+
+    if ( temp.tail > temp.head )
+      count = temp.tail - temp.head - 1;
+    else
+      count = SIZE - temp.head - (temp.tail == 0);
+
+    return &elements[temp.head];
+  }
+
+  // publish count elements written through write_span(), affects head
+  void commit_write(size_t count) {
+    register uint16_t temp_head = offsets.head;
+
+    __asm__ __volatile__ ("" ::: "memory"); // element stores land before head moves
+    offsets.head = (temp_head + count) & CAPACITY;
+  }
+
+  /*
+      read_span() - returns the contiguous used region starting at tail (up to the
+                    wrap point or head) and its length in count. Consume it in place,
+                    then release with commit_read().
+
+      Note: reader side only, reads head
+  */
+  T* read_span(size_t &count) {
+    register uint16x2_t temp = { offsets.both };
+
+    if ( temp.head >= temp.tail )
+      count = temp.head - temp.tail;
+    else
+      count = SIZE - temp.tail;
+
+    return &elements[temp.tail];
+  }
+
+  // release count elements consumed through read_span(), affects tail
+  void commit_read(size_t count) {
+    register uint16_t temp_tail = offsets.tail;
+
+    __asm__ __volatile__ ("" ::: "memory"); // element loads finish before tail moves
+    offsets.tail = (temp_tail + count) & CAPACITY;
+  }
+
 };
 
 #endif /* RINGBUFFER_T_H_ */
\ No newline at end of file
@@ -0,0 +1,243 @@
+#ifndef TEST_SUPPORT_H_
+#define TEST_SUPPORT_H_
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "native/HostBoard.h"
+#include "Player.h"
+//Shared by the native suites: a throwaway card directory, a VGM track builder that also records the
+//writes it should produce, and a player wired to the host stand-ins with a write log the tests can check
+
+struct LoggedWrite
+{
+  uint32_t sample; //Tick the write went out on, or is due on for an expected write
+  uint8_t addr;
+  uint8_t data;
+};
+
+//FNV-1a over sample, addr and data, the same fingerprint RecordingBus prints
+inline uint32_t writeChecksum(const std::vector<LoggedWrite> &writes)
+{
+  uint32_t sum = 2166136261UL;
+  for(size_t w = 0; w<writes.size(); w++)
+  {
+    uint32_t now = writes[w].sample;
+    uint8_t bytes[6] = {uint8_t(now), uint8_t(now >> 8), uint8_t(now >> 16), uint8_t(now >> 24), writes[w].addr, writes[w].data};
+    for(int i = 0; i<6; i++)
+    {
+      sum ^= bytes[i];
+      sum *= 16777619UL;
+    }
+  }
+  return sum;
+}
+
+//Records every write with its tick. busyTicks makes the chip report busy for that many ticks after
+//each write, like the YM2151 after a data write
+class LogBus : public ChipBus
+{
+public:
+  const HostTimer &timer;
+  std::vector<LoggedWrite> writes;
+  uint32_t clock;
+  uint32_t resets;
+  uint32_t busyTicks;
+  uint32_t busyUntil;
+  LogBus(const HostTimer &t) : timer(t), clock(0), resets(0), busyTicks(0), busyUntil(0) {}
+  void Reset() {resets++;}
+  void SetClock(uint32_t hz) {clock = hz;}
+  void Write(uint8_t addr, uint8_t data)
+  {
+    LoggedWrite w = {timer.Now(), addr, data};
+    writes.push_back(w);
+    busyUntil = timer.Now() + busyTicks;
+  }
+  bool Busy() {return int32_t(busyUntil - timer.Now()) > 0;}
+};
+
+class QuietDisplay : public Display
+{
+public:
+  std::string track;
+  void Begin() {}
+  void ShowMessage(const char *top, const char *bottom) {}
+  void ShowTrack(const char *t, const char *game, PlayMode mode) {track = t;}
+};
+
+//Input is handed out only up to what the test has released with Arrive(), so a command can show up a
+//few bytes at a time the way it does over the wire. Output is collected as text
+class ScriptSerial : public SerialPort
+{
+public:
+  std::string input;
+  size_t pos;
+  size_t arrived;
+  std::string output;
+  ScriptSerial() : pos(0), arrived(0) {}
+  void Send(const std::string &bytes) {input += bytes; arrived = input.size();}
+  void Queue(const std::string &bytes) {input += bytes;}
+  void Arrive(size_t count) {arrived = arrived + count < input.size() ? arrived + count : input.size();}
+  int Available() {return arrived - pos;}
+  int Read() {return pos < arrived ? (uint8_t)input[pos++] : -1;}
+  void Print(const char *text) {output += text;}
+  void PrintLine(const char *line) {output += line; output += "\n";}
+  void Write(const uint8_t *data, size_t size) {output.append((const char *)data, size);}
+};
+
+//Temporary directory standing in for the card, removed with everything in it
+class TestCard
+{
+public:
+  std::string path;
+  std::vector<std::string> files;
+  TestCard()
+  {
+    char name[] = "/tmp/ymcardXXXXXX";
+    path = mkdtemp(name) ? name : "";
+  }
+  ~TestCard()
+  {
+    for(size_t i = 0; i<files.size(); i++)
+      unlink((path + "/" + files[i]).c_str());
+    rmdir(path.c_str());
+  }
+  void Add(const std::string &name, const std::vector<uint8_t> &data)
+  {
+    FILE *f = fopen((path + "/" + name).c_str(), "wb");
+    if(!f)
+      return;
+    fwrite(data.data(), 1, data.size(), f);
+    fclose(f);
+    files.push_back(name);
+  }
+};
+
+//Builds a YM2151 VGM with the data at 0x100. expected holds every write with the sample it is due on
+class VgmBuilder
+{
+public:
+  std::vector<uint8_t> data;
+  std::vector<LoggedWrite> expected;
+  uint32_t samples;
+  uint32_t loopAt;
+  uint32_t loopSamples;
+  VgmBuilder(uint32_t version = 0x151, uint32_t clock = 3579545) : data(0x100, 0), samples(0), loopAt(0), loopSamples(0)
+  {
+    memcpy(&data[0], "Vgm ", 4);
+    Set(0x08, version);
+    Set(0x30, clock);
+    Set(0x34, 0x100 - 0x34);
+  }
+  void Set(uint32_t offset, uint32_t value)
+  {
+    for(int i = 0; i<4; i++)
+      data[offset+i] = value >> (i*8);
+  }
+  void Byte(uint8_t b) {data.push_back(b);}
+  void Write(uint8_t addr, uint8_t value)
+  {
+    Byte(0x54); Byte(addr); Byte(value);
+    LoggedWrite w = {samples, addr, value};
+    expected.push_back(w);
+  }
+  void Wait(uint32_t count)
+  {
+    samples += count;
+    while(count > 0)
+    {
+      uint16_t n = count > 0xFFFF ? 0xFFFF : count;
+      if(n == 735)
+        Byte(0x62);
+      else if(n <= 16)
+        Byte(0x70 + n - 1);
+      else
+      {
+        Byte(0x61); Byte(n); Byte(n >> 8);
+      }
+      count -= n;
+    }
+  }
+  //A PCM data block of size bytes, which the player has to step over
+  void DataBlock(uint32_t size, uint8_t type = 0x00)
+  {
+    Byte(0x67); Byte(0x66); Byte(type);
+    for(int i = 0; i<4; i++)
+      Byte(size >> (i*8));
+    for(uint32_t i = 0; i<size; i++)
+      Byte(i * 7);
+  }
+  void MarkLoop() {loopAt = data.size(); loopSamples = samples;}
+  std::vector<uint8_t> Finish()
+  {
+    Byte(0x66);
+    Set(0x04, data.size() - 4);
+    Set(0x18, samples);
+    if(loopAt)
+    {
+      Set(0x1C, loopAt - 0x1C);
+      Set(0x20, samples - loopSamples);
+    }
+    return data;
+  }
+};
+
+//Remembers every track the player opened, by directory index
+class LogStorage : public DirStorage
+{
+public:
+  std::vector<uint16_t> opened;
+  LogStorage(const char *root) : DirStorage(root) {}
+  bool Open(uint16_t dirIndex) {opened.push_back(dirIndex); return DirStorage::Open(dirIndex);}
+};
+
+static Player *testPlayer;
+
+static void testTick()
+{
+  testPlayer->Tick();
+}
+
+//Player on the host stand-ins. Play() paces the sample clock the way HostMain does, half the
+//schedule-ahead window behind the parser
+class TestRig
+{
+public:
+  LogStorage storage;
+  HostTimer timer;
+  LogBus bus;
+  QuietDisplay display;
+  ScriptSerial serial;
+  Player *player;
+  TestRig(const std::string &card) : storage(card.c_str()), bus(timer)
+  {
+    storage.Begin();
+    player = new Player(storage, bus, timer, display, serial);
+    testPlayer = player;
+  }
+  ~TestRig() {delete player;}
+  void Begin() {player->Begin(testTick);}
+  void Step()
+  {
+    player->Loop();
+    int32_t ahead = player->SamplesQueued();
+    timer.Run(ahead > SCHEDULE_AHEAD/2 ? ahead - SCHEDULE_AHEAD/2 : 1);
+  }
+  void Play(uint32_t samples)
+  {
+    uint32_t end = timer.Now() + samples;
+    while(int32_t(end - timer.Now()) > 0)
+      Step();
+  }
+  //Play until the track has looped count times, or limit samples have gone by
+  void PlayLoops(uint16_t count, uint32_t limit = 600*44100)
+  {
+    uint32_t end = timer.Now() + limit;
+    while(player->LoopCount() < count && int32_t(end - timer.Now()) > 0)
+      Step();
+  }
+};
+#endif
@@ -0,0 +1,99 @@
+//A PCM data block far bigger than the command buffer, on a card with read latency. Stepping over it
+//counts as a skip, not as the parser running dry, and the refill after it lands before the queue drains
+#include <unity.h>
+#include "../TestSupport.h"
+
+#define BLOCK_SIZE 200000
+
+static std::vector<uint8_t> blockTrack(VgmBuilder &vgm)
+{
+  for(int i = 0; i<200; i++)
+  {
+    vgm.Write(0x28 + i % 8, i);
+    vgm.Write(0x08, i % 8);
+    vgm.Wait(441);
+    if(i == 50)
+      vgm.DataBlock(BLOCK_SIZE);
+  }
+  return vgm.Finish();
+}
+
+static void playOver(uint32_t blockSamples, bool async)
+{
+  TestCard card;
+  VgmBuilder vgm;
+  card.Add("block.vgm", blockTrack(vgm));
+  TestRig rig(card.path);
+  rig.storage.SetLatency(&rig.timer, blockSamples, async);
+  rig.Begin();
+  rig.player->SetPlayMode(LOOP);
+  rig.PlayLoops(1, vgm.samples + 44100);
+  rig.Play(2*SCHEDULE_AHEAD);
+
+  PlaybackStats &stats = rig.player->Stats();
+  TEST_ASSERT_EQUAL_UINT32(1, stats.Skips());
+  TEST_ASSERT_EQUAL_UINT32(0, stats.BufferUnderruns());
+  TEST_ASSERT_EQUAL_UINT32(0, stats.QueueUnderruns());
+
+  //Opening the track costs card time too, so compare against the first write
+  const std::vector<LoggedWrite> &got = rig.bus.writes;
+  TEST_ASSERT_GREATER_OR_EQUAL(vgm.expected.size(), got.size());
+  for(size_t i = 0; i<vgm.expected.size(); i++)
+  {
+    TEST_ASSERT_EQUAL_HEX8(vgm.expected[i].addr, got[i].addr);
+    TEST_ASSERT_EQUAL_HEX8(vgm.expected[i].data, got[i].data);
+    TEST_ASSERT_EQUAL_UINT32(vgm.expected[i].sample - vgm.expected[0].sample, got[i].sample - got[0].sample);
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_no_latency()
+{
+  playOver(0, false);
+}
+
+static void test_background_reads()
+{
+  playOver(100, true);
+  playOver(400, true);
+}
+
+static void test_blocking_reads()
+{
+  playOver(100, false);
+}
+
+//A block that runs just past the buffer is streamed through rather than seeked over. Waiting on the
+//card partway through it is still part of the skip, not the parser running dry
+static void test_block_just_past_buffer()
+{
+  TestCard card;
+  VgmBuilder vgm;
+  vgm.DataBlock(CMD_BUFFER_SIZE);
+  for(int i = 0; i<100; i++)
+  {
+    vgm.Write(0x28, i);
+    vgm.Wait(441);
+  }
+  card.Add("block.vgm", vgm.Finish());
+  TestRig rig(card.path);
+  rig.Begin();
+  rig.Play(44100);
+  TEST_ASSERT_EQUAL_UINT32(0, rig.player->Stats().Skips());
+  TEST_ASSERT_EQUAL_UINT32(0, rig.player->Stats().BufferUnderruns());
+  TEST_ASSERT_GREATER_OR_EQUAL(100, rig.bus.writes.size());
+  for(int i = 0; i<100; i++)
+    TEST_ASSERT_EQUAL_HEX8(i, rig.bus.writes[i].data);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_no_latency);
+  RUN_TEST(test_background_reads);
+  RUN_TEST(test_blocking_reads);
+  RUN_TEST(test_block_just_past_buffer);
+  return UNITY_END();
+}
@@ -0,0 +1,88 @@
+//LTC6903 solver sweep. Solve() works in integer math, so it is checked against the datasheet formula in
+//floating point and against a brute force search of all 16384 settings
+#include <unity.h>
+#include <math.h>
+#include "LTC6903.h"
+
+static double exactFrequency(uint16_t oct, uint16_t dac)
+{
+  return ldexp(2078.0, oct) / (2.0 - dac / 1024.0);
+}
+
+void setUp() {}
+void tearDown() {}
+
+//Frequency() is the formula rounded to the nearest Hz, over every setting
+static void test_frequency_matches_the_formula()
+{
+  for(uint16_t oct = 0; oct <= LTC6903_MAX_OCT; oct++)
+    for(uint16_t dac = 0; dac <= LTC6903_MAX_DAC; dac++)
+      TEST_ASSERT_TRUE(fabs(LTC6903::Frequency(oct, dac) - exactFrequency(oct, dac)) <= 0.5);
+}
+
+//Over the whole range, in steps of about 0.01%, Solve() lands within half a step of the request and no
+//other setting is more than 1Hz closer
+static void test_solve_sweep()
+{
+  uint32_t checked = 0;
+  for(double f = LTC6903_MIN_HZ; f <= exactFrequency(LTC6903_MAX_OCT, LTC6903_MAX_DAC); f *= 1.0001)
+  {
+    uint32_t freq = (uint32_t)f;
+    uint16_t oct, dac;
+    LTC6903::Solve(freq, oct, dac);
+    TEST_ASSERT_LESS_OR_EQUAL(LTC6903_MAX_OCT, oct);
+    TEST_ASSERT_LESS_OR_EQUAL(LTC6903_MAX_DAC, dac);
+    double error = fabs(exactFrequency(oct, dac) - freq);
+    TEST_ASSERT_TRUE(error <= freq / 2048.0 + 1); //Neighbouring settings are at most 1/1024 apart
+    //Brute force every 64th point, it covers all the octave and DAC combinations well enough
+    if(checked++ % 64 == 0)
+    {
+      double best = 1e12;
+      for(uint16_t o = 0; o <= LTC6903_MAX_OCT; o++)
+        for(uint16_t d = 0; d <= LTC6903_MAX_DAC; d++)
+          best = fmin(best, fabs(exactFrequency(o, d) - freq));
+      TEST_ASSERT_TRUE(error <= best + 1);
+    }
+  }
+  TEST_ASSERT_GREATER_THAN(100000, checked);
+}
+
+//Requests off either end of the range clamp to the nearest setting
+static void test_solve_clamps()
+{
+  uint16_t oct, dac;
+  LTC6903::Solve(0, oct, dac);
+  TEST_ASSERT_EQUAL(0, oct);
+  TEST_ASSERT_EQUAL(0, dac);
+  LTC6903::Solve(LTC6903_MIN_HZ - 1, oct, dac);
+  TEST_ASSERT_EQUAL(0, oct);
+  TEST_ASSERT_EQUAL(0, dac);
+  LTC6903::Solve(100000000, oct, dac);
+  TEST_ASSERT_EQUAL(LTC6903_MAX_OCT, oct);
+  TEST_ASSERT_EQUAL(LTC6903_MAX_DAC, dac);
+}
+
+//The usual YM2151 clocks, and SetFrequency() reporting the programmed error
+static void test_common_clocks()
+{
+  static const uint32_t clocks[] = {3579545, 3579580, 4000000, 3375000, 3500000, 2000000};
+  LTC6903 ltc(0);
+  for(unsigned i = 0; i<sizeof(clocks)/sizeof(clocks[0]); i++)
+  {
+    uint16_t oct, dac;
+    LTC6903::Solve(clocks[i], oct, dac);
+    int32_t error = ltc.SetFrequency(clocks[i]);
+    TEST_ASSERT_EQUAL_INT32((int32_t)(LTC6903::Frequency(oct, dac) - clocks[i]), error);
+    TEST_ASSERT_TRUE(abs(error) * 2000 < clocks[i]); //Within 0.05%
+  }
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_frequency_matches_the_formula);
+  RUN_TEST(test_solve_sweep);
+  RUN_TEST(test_solve_clamps);
+  RUN_TEST(test_common_clocks);
+  return UNITY_END();
+}
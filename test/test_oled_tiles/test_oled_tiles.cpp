@@ -0,0 +1,187 @@
+//OLEDTiles against a simulated panel. Whatever order redraws and slices come in, once the slices run out
+//the panel has to hold the frame buffer, and each slice has to be a run of at most OLED_SLICE_TILES
+#include <unity.h>
+#include <string.h>
+#include "OLEDTiles.h"
+
+#define FRAME_SIZE (OLED_TILE_ROWS*OLED_WIDTH)
+
+static uint8_t frame[FRAME_SIZE];
+static uint8_t panel[FRAME_SIZE];
+static OLEDTiles tiles;
+static uint32_t rng;
+static uint32_t sentTiles;
+
+static uint32_t nextRandom()
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+//What updateDisplayArea() does: copy the run of tiles from the frame buffer to the panel
+static bool sendSlice()
+{
+  uint8_t tx, ty, tw;
+  if(!tiles.NextSlice(tx, ty, tw))
+    return false;
+  TEST_ASSERT_LESS_THAN(OLED_TILE_ROWS, ty);
+  TEST_ASSERT_TRUE(tw >= 1 && tw <= OLED_SLICE_TILES);
+  TEST_ASSERT_LESS_OR_EQUAL(OLED_TILE_COLS, tx + tw);
+  memcpy(panel + ty*OLED_WIDTH + tx*8, frame + ty*OLED_WIDTH + tx*8, tw*8);
+  sentTiles += tw;
+  return true;
+}
+
+static uint32_t drain()
+{
+  uint32_t slices = 0;
+  while(sendSlice())
+    slices++;
+  return slices;
+}
+
+static void fillTile(uint8_t tx, uint8_t ty, uint8_t value)
+{
+  memset(frame + ty*OLED_WIDTH + tx*8, value, 8);
+}
+
+void setUp()
+{
+  memset(frame, 0, sizeof(frame));
+  memset(panel, 0, sizeof(panel));
+  tiles.Reset();
+  rng = 0x2545F491;
+  sentTiles = 0;
+}
+
+void tearDown() {}
+
+static void test_blank_tiles_are_not_sent()
+{
+  fillTile(3, 1, 0x81);
+  tiles.Redrawn(frame, 0, OLED_TILE_ROWS-1);
+  TEST_ASSERT_EQUAL(1, drain());
+  TEST_ASSERT_EQUAL_MEMORY(frame, panel, FRAME_SIZE);
+
+  //The same frame again only resends the lit tile, a blank frame clears it, a second blank frame sends nothing
+  tiles.Redrawn(frame, 0, OLED_TILE_ROWS-1);
+  TEST_ASSERT_EQUAL(1, drain());
+  fillTile(3, 1, 0);
+  tiles.Redrawn(frame, 0, OLED_TILE_ROWS-1);
+  TEST_ASSERT_EQUAL(1, drain());
+  TEST_ASSERT_EQUAL_MEMORY(frame, panel, FRAME_SIZE);
+  tiles.Redrawn(frame, 0, OLED_TILE_ROWS-1);
+  TEST_ASSERT_EQUAL(0, drain());
+}
+
+static void test_runs_are_split_into_slices()
+{
+  for(uint8_t tx = 0; tx < OLED_TILE_COLS; tx++)
+    fillTile(tx, 2, 0xFF);
+  fillTile(5, 0, 0x10);
+  fillTile(6, 0, 0x10);
+  tiles.Redrawn(frame, 0, OLED_TILE_ROWS-1);
+  uint8_t tx, ty, tw;
+  TEST_ASSERT_TRUE(tiles.NextSlice(tx, ty, tw));
+  TEST_ASSERT_EQUAL(5, tx); TEST_ASSERT_EQUAL(0, ty); TEST_ASSERT_EQUAL(2, tw);
+  for(uint8_t i = 0; i < OLED_TILE_COLS/OLED_SLICE_TILES; i++)
+  {
+    TEST_ASSERT_TRUE(tiles.NextSlice(tx, ty, tw));
+    TEST_ASSERT_EQUAL(i*OLED_SLICE_TILES, tx); TEST_ASSERT_EQUAL(2, ty); TEST_ASSERT_EQUAL(OLED_SLICE_TILES, tw);
+  }
+  TEST_ASSERT_FALSE(tiles.NextSlice(tx, ty, tw));
+}
+
+//What a mode toggle costs: ShowTrack() redraws the whole frame, so with only the mode label changed every
+//tile with text in it is sent again. Only the blank ones are saved
+static void test_redraw_resends_every_lit_tile()
+{
+  uint32_t lit = 0;
+  for(uint8_t ty = 0; ty < 3; ty++)
+  {
+    for(uint8_t tx = 0; tx < 10; tx++, lit++)
+      fillTile(tx, ty, 0x3C);
+  }
+  fillTile(0, 3, 0x7E); //"LOOP"
+  fillTile(1, 3, 0x7E);
+  lit += 2;
+  tiles.Redrawn(frame, 0, OLED_TILE_ROWS-1);
+  drain();
+  TEST_ASSERT_EQUAL_UINT32(lit, sentTiles);
+
+  sentTiles = 0;
+  fillTile(1, 3, 0x42); //"SHUFFLE"
+  fillTile(2, 3, 0x42);
+  lit++;
+  tiles.Redrawn(frame, 0, OLED_TILE_ROWS-1);
+  drain();
+  TEST_ASSERT_EQUAL_UINT32(lit, sentTiles);
+  TEST_ASSERT_EQUAL_MEMORY(frame, panel, FRAME_SIZE);
+
+  //Redrawing just the label's row costs that row's lit tiles, and the one it blanked
+  sentTiles = 0;
+  fillTile(2, 3, 0);
+  tiles.Redrawn(frame, 3, 3);
+  drain();
+  TEST_ASSERT_EQUAL_UINT32(3, sentTiles);
+  TEST_ASSERT_EQUAL_MEMORY(frame, panel, FRAME_SIZE);
+}
+
+//Rows outside a partial redraw keep their pending tiles and are not rescanned
+static void test_partial_redraw_keeps_other_rows()
+{
+  fillTile(0, 0, 1);
+  fillTile(0, 3, 1);
+  tiles.Redrawn(frame, 0, OLED_TILE_ROWS-1);
+  fillTile(1, 1, 1);
+  tiles.Redrawn(frame, 1, 2);
+  TEST_ASSERT_EQUAL(3, drain());
+  TEST_ASSERT_EQUAL_MEMORY(frame, panel, FRAME_SIZE);
+}
+
+//Random full and partial redraws, like track changes and ticker steps, with a random number of slices
+//sent in between. Redraws only touch their own rows, as the ticker's clip window makes sure of
+static void test_random_redraws_match_the_panel()
+{
+  for(int round = 0; round < 20000; round++)
+  {
+    uint8_t first = nextRandom() % OLED_TILE_ROWS;
+    uint8_t last = first + nextRandom() % (OLED_TILE_ROWS - first);
+    if(nextRandom() % 4 == 0)
+    {
+      first = 0;
+      last = OLED_TILE_ROWS-1;
+    }
+    for(uint8_t ty = first; ty <= last; ty++)
+    {
+      //Clear the row now and then, then touch a few bytes. Some writes put back what was there
+      if(nextRandom() % 3 == 0)
+        memset(frame + ty*OLED_WIDTH, 0, OLED_WIDTH);
+      for(int n = nextRandom() % 24; n > 0; n--)
+        frame[ty*OLED_WIDTH + nextRandom() % OLED_WIDTH] = nextRandom() % 3 ? nextRandom() : 0;
+    }
+    tiles.Redrawn(frame, first, last);
+    for(int n = nextRandom() % 6; n > 0; n--)
+      sendSlice();
+    if(round % 97 == 0)
+    {
+      drain();
+      TEST_ASSERT_EQUAL_MEMORY(frame, panel, FRAME_SIZE);
+    }
+  }
+  drain();
+  TEST_ASSERT_EQUAL_MEMORY(frame, panel, FRAME_SIZE);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_blank_tiles_are_not_sent);
+  RUN_TEST(test_runs_are_split_into_slices);
+  RUN_TEST(test_redraw_resends_every_lit_tile);
+  RUN_TEST(test_partial_redraw_keeps_other_rows);
+  RUN_TEST(test_random_redraws_match_the_panel);
+  return UNITY_END();
+}
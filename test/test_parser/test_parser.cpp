@@ -0,0 +1,233 @@
+//Parser fuzz runs. Random tracks mix YM2151 writes with every wait form, other chips' commands of every
+//length in the VGM spec and PCM data blocks. Each YM2151 write must come out once, in order, on the
+//sample the waits before it add up to
+#include <unity.h>
+#include "../TestSupport.h"
+#include "OPMStream.h"
+
+#define FUZZ_TRACKS 24
+#define FUZZ_COMMANDS 4000
+
+static uint32_t rng;
+
+static uint32_t nextRandom()
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+//Operand bytes of another chip's command, from the VGM 1.71 command list rather than the player's table
+static uint8_t foreignLength(uint8_t cmd)
+{
+  if(cmd >= 0x30 && cmd <= 0x3F)
+    return 1;
+  if(cmd == 0x4F || cmd == 0x50)
+    return 1;
+  if((cmd >= 0x40 && cmd <= 0x4E) || (cmd >= 0x51 && cmd <= 0x5F))
+    return 2;
+  if(cmd == 0x68)
+    return 11;
+  if(cmd >= 0x90 && cmd <= 0x95)
+  {
+    static const uint8_t lengths[6] = {4, 4, 5, 10, 1, 4};
+    return lengths[cmd - 0x90];
+  }
+  if(cmd >= 0xA0 && cmd <= 0xBF)
+    return 2;
+  if(cmd >= 0xC0 && cmd <= 0xDF)
+    return 3;
+  return 4; //0xE0-0xFF
+}
+
+static uint8_t foreignCommand()
+{
+  static const uint8_t ranges[][2] = {{0x30, 0x3F}, {0x40, 0x53}, {0x55, 0x5F}, {0x68, 0x68}, {0x90, 0x95}, {0xA0, 0xFF}};
+  const uint8_t *r = ranges[nextRandom() % 6];
+  return r[0] + nextRandom() % (r[1] - r[0] + 1);
+}
+
+static std::vector<uint8_t> fuzzVgm(VgmBuilder &vgm)
+{
+  for(int i = 0; i<FUZZ_COMMANDS; i++)
+  {
+    uint32_t r = nextRandom() % 100;
+    if(r < 45)
+    {
+      //Bursts of writes, as a key on or a patch load produces. Each is followed by a wait so no sample
+      //carries more writes than the event queue holds
+      int burst = 1 + nextRandom() % 12;
+      for(int b = 0; b<burst; b++)
+        vgm.Write(0x08 + nextRandom() % 0xF8, nextRandom());
+      vgm.Wait(1 + nextRandom() % 16);
+    }
+    else if(r < 75)
+    {
+      switch(nextRandom() % 5)
+      {
+        case 0:
+          vgm.Byte(0x61);
+          {
+            uint16_t n = nextRandom() % 3000;
+            vgm.Byte(n); vgm.Byte(n >> 8);
+            vgm.samples += n;
+          }
+        break;
+        case 1:
+          vgm.Byte(0x62);
+          vgm.samples += 735;
+        break;
+        case 2:
+          vgm.Byte(0x63);
+          vgm.samples += 882;
+        break;
+        case 3:
+        {
+          uint8_t n = nextRandom() % 16;
+          vgm.Byte(0x70 + n);
+          vgm.samples += n + 1;
+        }
+        break;
+        default:
+        {
+          uint8_t n = nextRandom() % 16;
+          vgm.Byte(0x80 + n); //YM2612 DAC write from the data bank, then a wait of n
+          vgm.samples += n;
+        }
+      }
+    }
+    else if(r < 97)
+    {
+      uint8_t cmd = foreignCommand();
+      vgm.Byte(cmd);
+      for(uint8_t b = foreignLength(cmd); b > 0; b--)
+        vgm.Byte(nextRandom());
+    }
+    else
+    {
+      //Mostly small blocks that stay in the buffer, now and then one big enough to be seeked over
+      uint32_t size = nextRandom() % 8 ? nextRandom() % 600 : 8192 + nextRandom() % 40000;
+      vgm.DataBlock(size, nextRandom());
+    }
+  }
+  return vgm.Finish();
+}
+
+//The first pass of the track must match what the builder expects. HostTimer::Now() counts a tick once it
+//has fired, so sample t is played on tick t+1
+static void checkWrites(const std::vector<LoggedWrite> &expected, const std::vector<LoggedWrite> &got)
+{
+  TEST_ASSERT_GREATER_OR_EQUAL(expected.size(), got.size());
+  for(size_t i = 0; i<expected.size(); i++)
+  {
+    char where[64];
+    snprintf(where, sizeof(where), "write %u of %u", (unsigned)i, (unsigned)expected.size());
+    TEST_ASSERT_EQUAL_HEX32_MESSAGE(expected[i].addr, got[i].addr, where);
+    TEST_ASSERT_EQUAL_HEX32_MESSAGE(expected[i].data, got[i].data, where);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(expected[i].sample + 1, got[i].sample, where);
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_fuzzed_vgm_tracks()
+{
+  for(uint32_t seed = 1; seed <= FUZZ_TRACKS; seed++)
+  {
+    rng = seed * 2654435761UL;
+    TestCard card;
+    VgmBuilder vgm;
+    card.Add("fuzz.vgm", fuzzVgm(vgm));
+    TestRig rig(card.path);
+    rig.Begin();
+    rig.player->SetPlayMode(LOOP);
+    rig.PlayLoops(1, vgm.samples + 44100);
+    TEST_ASSERT_EQUAL(1, rig.player->LoopCount());
+    rig.Play(2*SCHEDULE_AHEAD); //The parser reaches the end that far ahead of the clock
+    checkWrites(vgm.expected, rig.bus.writes);
+  }
+}
+
+//The same kind of tracks as an OPM stream, with registers below 0x08 going through the escape command
+static void test_fuzzed_opm_streams()
+{
+  for(uint32_t seed = 1; seed <= FUZZ_TRACKS; seed++)
+  {
+    rng = seed * 40503UL + 7;
+    std::vector<uint8_t> opm(OPM_HEADER_SIZE, 0);
+    std::vector<LoggedWrite> expected;
+    uint32_t samples = 0;
+    for(int i = 0; i<FUZZ_COMMANDS; i++)
+    {
+      if(nextRandom() % 2)
+      {
+        LoggedWrite w = {samples, uint8_t(nextRandom() % 16 ? 0x08 + nextRandom() % 0xF8 : nextRandom() % 8), uint8_t(nextRandom())};
+        if(w.addr < OPM_MIN_DIRECT_REG)
+          opm.push_back(OPM_WRITE_LOW);
+        opm.push_back(w.addr);
+        opm.push_back(w.data);
+        expected.push_back(w);
+      }
+      else if(nextRandom() % 2)
+      {
+        uint8_t n = nextRandom();
+        opm.push_back(OPM_WAIT8);
+        opm.push_back(n);
+        samples += n + 1;
+      }
+      else
+      {
+        uint16_t n = nextRandom() % 5000;
+        opm.push_back(OPM_WAIT16);
+        opm.push_back(n);
+        opm.push_back(n >> 8);
+        samples += n;
+      }
+    }
+    opm.push_back(OPM_END);
+    uint32_t header[8] = {OPM_IDENT, (uint32_t)opm.size(), OPM_VERSION, 3579545, samples, OPM_HEADER_SIZE, samples, OPM_HEADER_SIZE};
+    for(int i = 0; i<8; i++)
+      for(int b = 0; b<4; b++)
+        opm[i*4 + b] = header[i] >> (b*8);
+    TestCard card;
+    card.Add("fuzz.opm", opm);
+    TestRig rig(card.path);
+    rig.Begin();
+    rig.player->SetPlayMode(LOOP);
+    rig.PlayLoops(1, samples + 44100);
+    TEST_ASSERT_EQUAL(1, rig.player->LoopCount());
+    rig.Play(2*SCHEDULE_AHEAD); //The parser reaches the end that far ahead of the clock
+    checkWrites(expected, rig.bus.writes);
+  }
+}
+
+//Random bytes after a valid header. Unknown opcodes and absurd block sizes must not hang or crash the
+//player, and the sample clock has to keep going
+static void test_garbage_does_not_stall()
+{
+  for(uint32_t seed = 1; seed <= FUZZ_TRACKS; seed++)
+  {
+    rng = seed * 69069UL + 1;
+    VgmBuilder vgm;
+    for(int i = 0; i<20000; i++)
+      vgm.Byte(nextRandom());
+    TestCard card;
+    card.Add("garbage.vgm", vgm.Finish());
+    TestRig rig(card.path);
+    rig.Begin();
+    rig.player->SetPlayMode(LOOP);
+    rig.Play(10*44100);
+    TEST_ASSERT_GREATER_OR_EQUAL(10*44100, rig.timer.Now());
+  }
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_fuzzed_vgm_tracks);
+  RUN_TEST(test_fuzzed_opm_streams);
+  RUN_TEST(test_garbage_does_not_stall);
+  return UNITY_END();
+}
@@ -0,0 +1,85 @@
+//Write timing must not depend on how slow the card is, as long as reads run in the background. Tracks
+//are played with no latency and with 100 and 400 samples per block read, and the checksums of their
+//writes compared, the same check as the host build's -d and -a options
+#include <unity.h>
+#include "../TestSupport.h"
+
+static uint32_t rng;
+
+static uint32_t nextRandom()
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+//Dense bursts and short waits, small data blocks throughout, a few big ones and a loop point partway through
+static std::vector<uint8_t> randomTrack(VgmBuilder &vgm)
+{
+  for(int i = 0; i<3000; i++)
+  {
+    if(i == 1000)
+      vgm.MarkLoop();
+    if(i % 700 == 350)
+      vgm.DataBlock(20000 + nextRandom() % 60000);
+    uint32_t r = nextRandom() % 100;
+    if(r < 60)
+    {
+      for(int b = 1 + nextRandom() % 8; b > 0; b--)
+        vgm.Write(0x08 + nextRandom() % 0xF8, nextRandom());
+      vgm.Wait(1 + nextRandom() % 200);
+    }
+    else if(r < 98)
+      vgm.Wait(nextRandom() % 900);
+    else
+      vgm.DataBlock(nextRandom() % 2000);
+  }
+  return vgm.Finish();
+}
+
+//Checksum of the writes in the first samples of playback, timed from the first write so the card
+//time spent opening the track doesn't count
+static uint32_t play(const std::string &path, uint32_t samples, uint32_t blockSamples)
+{
+  TestRig rig(path);
+  rig.storage.SetLatency(&rig.timer, blockSamples, blockSamples != 0);
+  rig.Begin();
+  rig.player->SetPlayMode(LOOP);
+  while(rig.bus.writes.empty() || rig.timer.Now() - rig.bus.writes[0].sample < samples + 2*SCHEDULE_AHEAD)
+    rig.Step();
+  TEST_ASSERT_EQUAL_UINT32(0, rig.player->Stats().QueueUnderruns());
+  std::vector<LoggedWrite> timed;
+  for(size_t i = 0; i<rig.bus.writes.size() && rig.bus.writes[i].sample - rig.bus.writes[0].sample < samples; i++)
+  {
+    timed.push_back(rig.bus.writes[i]);
+    timed.back().sample -= rig.bus.writes[0].sample;
+  }
+  TEST_ASSERT_GREATER_THAN(1000, timed.size());
+  return writeChecksum(timed);
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_checksums_match_across_latency()
+{
+  for(uint32_t seed = 1; seed <= 6; seed++)
+  {
+    rng = seed * 2654435761UL;
+    TestCard card;
+    VgmBuilder vgm;
+    card.Add("track.vgm", randomTrack(vgm));
+    uint32_t samples = vgm.samples + (vgm.samples - vgm.loopSamples); //Into the second pass, so the loop wrap counts
+    uint32_t reference = play(card.path, samples, 0);
+    TEST_ASSERT_EQUAL_HEX32(reference, play(card.path, samples, 100));
+    TEST_ASSERT_EQUAL_HEX32(reference, play(card.path, samples, 400));
+  }
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_checksums_match_across_latency);
+  return UNITY_END();
+}
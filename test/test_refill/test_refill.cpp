@@ -0,0 +1,123 @@
+//Command buffer refill through Player::TopUpBuffer(), the same track played twice: once from a card that
+//serves each read a byte per call, as the old topUpBuffer() pulled the file in, and once from one that
+//reads the spans asked for. Both must get every write to the chip, and the span reads must stay at about
+//one per block. The refill rate of each, from the player's own stats, is printed
+#include <unity.h>
+#include "../TestSupport.h"
+#include "CycleCounter.h"
+
+#define REFILL_STEPS 80000 //Steps of four writes and a short wait, about 1MB of commands
+
+//Counts read calls. With byteReads set a read is done one byte per call
+class CountingStorage : public DirStorage
+{
+public:
+  uint32_t reads;
+  bool byteReads;
+  CountingStorage(const char *root) : DirStorage(root), reads(0), byteReads(false) {}
+  int Read(void *dst, uint32_t count)
+  {
+    if(!byteReads)
+    {
+      reads++;
+      return DirStorage::Read(dst, count);
+    }
+    uint8_t *p = (uint8_t *)dst;
+    uint32_t got = 0;
+    for(; got < count; got++)
+    {
+      reads++;
+      if(DirStorage::Read(p + got, 1) != 1)
+        break;
+    }
+    return got;
+  }
+};
+
+struct RefillRun
+{
+  uint32_t reads; //Read calls once the track was open
+  double rate; //MB/s over the player's refills
+};
+
+static std::vector<uint8_t> refillTrack(VgmBuilder &vgm)
+{
+  for(uint32_t i = 0; i<REFILL_STEPS; i++)
+  {
+    for(int w = 0; w<4; w++)
+      vgm.Write(0x20 + ((i + w) & 0x3F), i + w);
+    vgm.Wait(1 + i % 16);
+  }
+  return vgm.Finish();
+}
+
+//Play the track through once. Reads made opening it, the header, GD3 and first fill, aren't counted
+static RefillRun play(const std::string &path, const VgmBuilder &vgm, bool byteReads)
+{
+  CountingStorage storage(path.c_str());
+  TEST_ASSERT_TRUE(storage.Begin());
+  HostTimer timer;
+  LogBus bus(timer);
+  QuietDisplay display;
+  ScriptSerial serial;
+  Player player(storage, bus, timer, display, serial);
+  testPlayer = &player;
+  player.SetPlayMode(LOOP);
+  player.Begin(testTick);
+  storage.reads = 0;
+  storage.byteReads = byteReads;
+  uint32_t end = timer.Now() + vgm.samples + 44100;
+  uint32_t drained = 0;
+  while(int32_t(end - timer.Now()) > 0 && (player.LoopCount() < 1 || int32_t(drained - timer.Now()) > 0))
+  {
+    if(player.LoopCount() < 1)
+      drained = timer.Now() + 2*SCHEDULE_AHEAD; //What was queued when the track ended has played by then
+    player.Loop();
+    int32_t ahead = player.SamplesQueued();
+    timer.Run(ahead > SCHEDULE_AHEAD/2 ? ahead - SCHEDULE_AHEAD/2 : 1);
+  }
+  TEST_ASSERT_EQUAL(1, player.LoopCount());
+
+  TEST_ASSERT_GREATER_OR_EQUAL(vgm.expected.size(), bus.writes.size());
+  for(size_t i = 0; i<vgm.expected.size(); i++)
+  {
+    TEST_ASSERT_EQUAL_HEX8(vgm.expected[i].addr, bus.writes[i].addr);
+    TEST_ASSERT_EQUAL_HEX8(vgm.expected[i].data, bus.writes[i].data);
+  }
+  RefillRun run;
+  run.reads = storage.reads;
+  uint32_t us = player.Stats().RefillTicks() / CYCLE_TICKS_PER_US;
+  run.rate = (double)player.Stats().RefillBytes() / (us ? us : 1);
+  return run;
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_span_refill_reads()
+{
+  TestCard card;
+  VgmBuilder vgm;
+  card.Add("refill.vgm", refillTrack(vgm));
+  uint32_t commandBytes = vgm.data.size() - 0x100;
+
+  RefillRun bytes = play(card.path, vgm, true);
+  RefillRun spans = play(card.path, vgm, false);
+
+  //Past the first fill every byte was its own call
+  TEST_ASSERT_GREATER_OR_EQUAL(commandBytes - CMD_BUFFER_SIZE, bytes.reads);
+  //About one read per block, at most one more where a span stops at the buffer's wrap point
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(commandBytes / SD_BLOCK_SIZE * 2 + 2, spans.reads);
+
+  char line[128];
+  snprintf(line, sizeof(line), "%u command bytes. Byte at a time: %.1f MB/s, %u reads. Spans: %.1f MB/s, %u reads",
+    (unsigned)commandBytes, bytes.rate, (unsigned)bytes.reads, spans.rate, (unsigned)spans.reads);
+  TEST_MESSAGE(line);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_span_refill_reads);
+  return UNITY_END();
+}
@@ -0,0 +1,173 @@
+//ringbuffer_t span API. The stress test runs a producer and a consumer thread against each other the
+//way Loop() and the tick ISR share the event queue, with span lengths that keep crossing the wrap point
+#include <unity.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include "ringbuffer.h"
+
+#define STRESS_ITEMS 2000000
+
+typedef ringbuffer_t<uint8_t, 64, uint8_t> SmallBuffer;
+typedef ringbuffer_t<uint32_t, 256, uint32_t> StressBuffer;
+
+static StressBuffer stress;
+static volatile bool stressFailed;
+
+void setUp() {}
+void tearDown() {}
+
+//Cheap per-thread generator so span lengths vary without sharing state
+static uint32_t nextRandom(uint32_t &state)
+{
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+static void test_spans_split_at_the_wrap()
+{
+  SmallBuffer rb;
+  rb.clear();
+  size_t count;
+
+  //Move head and tail to 60, 4 slots short of the wrap
+  rb.write_span(count);
+  TEST_ASSERT_EQUAL(63, count);
+  rb.commit_write(60);
+  rb.read_span(count);
+  TEST_ASSERT_EQUAL(60, count);
+  rb.commit_read(60);
+  TEST_ASSERT_TRUE(rb.empty());
+
+  //The free region runs to the end of the array first, then from 0 up to the slot before tail
+  uint8_t *span = rb.write_span(count);
+  TEST_ASSERT_EQUAL(4, count);
+  for(int i = 0; i < 4; i++)
+    span[i] = i;
+  rb.commit_write(4);
+  span = rb.write_span(count);
+  TEST_ASSERT_TRUE(span == rb.elements);
+  TEST_ASSERT_EQUAL(59, count);
+  for(int i = 0; i < 10; i++)
+    span[i] = 4 + i;
+  rb.commit_write(10);
+  TEST_ASSERT_EQUAL(14, rb.available());
+
+  //Reads split at the same place and come back in order
+  span = rb.read_span(count);
+  TEST_ASSERT_EQUAL(4, count);
+  for(int i = 0; i < 4; i++)
+    TEST_ASSERT_EQUAL(i, span[i]);
+  rb.commit_read(4);
+  span = rb.read_span(count);
+  TEST_ASSERT_EQUAL(10, count);
+  for(int i = 0; i < 10; i++)
+    TEST_ASSERT_EQUAL(4 + i, span[i]);
+  rb.commit_read(10);
+  TEST_ASSERT_TRUE(rb.empty());
+}
+
+static void test_full_buffer_keeps_one_slot_open()
+{
+  SmallBuffer rb;
+  rb.clear();
+  for(int i = 0; i < 100; i++)
+    rb.push_back(i);
+  TEST_ASSERT_TRUE(rb.full());
+  TEST_ASSERT_EQUAL(63, rb.available());
+  size_t count;
+  rb.write_span(count);
+  TEST_ASSERT_EQUAL(0, count);
+  for(int i = 0; i < 63; i++)
+    TEST_ASSERT_EQUAL(i, rb.pop_front());
+  TEST_ASSERT_TRUE(rb.empty());
+  rb.read_span(count);
+  TEST_ASSERT_EQUAL(0, count);
+}
+
+//Writes an increasing sequence, alternating random length span commits with single push_back calls
+static void *produce(void *)
+{
+  uint32_t state = 0x12345678;
+  uint32_t next = 0;
+  while(next < STRESS_ITEMS && !stressFailed)
+  {
+    size_t count;
+    uint32_t *span = stress.write_span(count);
+    if(!count)
+    {
+      sched_yield(); //Full. On a single core the consumer only runs once this thread gives way
+      continue;
+    }
+    uint32_t r = nextRandom(state);
+    if(r & 1)
+    {
+      if(!stress.full())
+        stress.push_back(next++);
+      continue;
+    }
+    size_t take = 1 + (r >> 8) % count;
+    if(take > STRESS_ITEMS - next)
+      take = STRESS_ITEMS - next;
+    for(size_t i = 0; i < take; i++)
+      span[i] = next++;
+    stress.commit_write(take);
+  }
+  return NULL;
+}
+
+//Takes the sequence back with random length span reads and pop_front, checking nothing is lost, repeated or torn
+static void *consume(void *)
+{
+  uint32_t state = 0x9E3779B9;
+  uint32_t expect = 0;
+  while(expect < STRESS_ITEMS && !stressFailed)
+  {
+    size_t count;
+    uint32_t *span = stress.read_span(count);
+    if(!count)
+    {
+      sched_yield();
+      continue;
+    }
+    uint32_t r = nextRandom(state);
+    if(r & 1)
+    {
+      if(stress.pop_front() != expect++)
+        stressFailed = true;
+      continue;
+    }
+    size_t take = 1 + (r >> 8) % count;
+    for(size_t i = 0; i < take; i++)
+    {
+      if(span[i] != expect++)
+        stressFailed = true;
+    }
+    stress.commit_read(take);
+  }
+  return NULL;
+}
+
+static void test_producer_consumer_stress()
+{
+  pthread_t producer, consumer;
+  stress.clear();
+  stressFailed = false;
+  TEST_ASSERT_EQUAL(0, pthread_create(&consumer, NULL, consume, NULL));
+  TEST_ASSERT_EQUAL(0, pthread_create(&producer, NULL, produce, NULL));
+  pthread_join(producer, NULL);
+  pthread_join(consumer, NULL);
+  TEST_ASSERT_FALSE(stressFailed);
+  TEST_ASSERT_TRUE(stress.empty());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_spans_split_at_the_wrap);
+  RUN_TEST(test_full_buffer_keeps_one_slot_open);
+  RUN_TEST(test_producer_consumer_stress);
+  return UNITY_END();
+}
@@ -0,0 +1,184 @@
+//Seeking with the 's' serial command. The chip has to end up holding what the track had written by the
+//target, playback has to carry on from there, and no single Loop() pass may do the whole job
+#include <unity.h>
+#include "../TestSupport.h"
+
+#define SEEK_SECONDS 3
+#define TRACK_STEPS 600 //Steps of 10mS, each with a few writes
+
+static std::vector<uint8_t> seekTrack(VgmBuilder &vgm, uint32_t &commandBytes)
+{
+  commandBytes = 0;
+  uint32_t blockBytes = 0;
+  for(uint32_t i = 0; i<TRACK_STEPS; i++)
+  {
+    uint8_t ch = i % 8;
+    vgm.Write(0x20 + ch, 0xC0 | (i % 7 + 1));
+    vgm.Write(0x28 + ch, i);
+    vgm.Write(0x60 + (i % 32), i & 0x7F);
+    vgm.Write(0x08, 0x78 | ch);
+    vgm.Wait(441);
+    if(i % 100 == 50)
+    {
+      vgm.DataBlock(20000); //Stepped over by moving the read position
+      blockBytes += 20000;
+    }
+    if(vgm.samples <= SEEK_SECONDS*44100)
+      commandBytes = vgm.data.size() - 0x100 - blockBytes;
+  }
+  return vgm.Finish();
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_seek_reloads_registers()
+{
+  TestCard card;
+  VgmBuilder vgm;
+  uint32_t commandBytes;
+  card.Add("seek.vgm", seekTrack(vgm, commandBytes));
+  TestRig rig(card.path);
+  rig.Begin();
+  rig.player->SetPlayMode(LOOP);
+  rig.Play(44100);
+
+  rig.serial.Send("s:3\n");
+  uint32_t resets = rig.bus.resets;
+  size_t reloadFrom = 0;
+  uint32_t passes = 0;
+  rig.player->Loop(); //Takes the command
+  TEST_ASSERT_TRUE(rig.player->Seeking());
+  while(rig.player->Seeking() && passes < 100000)
+  {
+    rig.player->Loop();
+    passes++;
+    if(rig.bus.resets != resets)
+    {
+      resets = rig.bus.resets;
+      reloadFrom = rig.bus.writes.size();
+    }
+  }
+  TEST_ASSERT_FALSE(rig.player->Seeking());
+  TEST_ASSERT_GREATER_THAN(0, reloadFrom);
+  //Data blocks count against the budget too, so this only bounds it from below
+  TEST_ASSERT_GREATER_OR_EQUAL(commandBytes / (2*SEEK_BYTES_PER_LOOP) + 256 / SEEK_REGS_PER_LOOP, passes);
+
+  //Last value of every register before the target, reloaded in register order. Key ons are left out
+  //and registers still 0 after the reset aren't written
+  const uint32_t target = SEEK_SECONDS*44100;
+  uint8_t regs[256];
+  memset(regs, 0, sizeof(regs));
+  for(size_t i = 0; i<vgm.expected.size() && vgm.expected[i].sample < target; i++)
+    regs[vgm.expected[i].addr] = vgm.expected[i].data;
+  std::vector<LoggedWrite> reload(rig.bus.writes.begin() + reloadFrom, rig.bus.writes.end());
+  size_t w = 0;
+  for(uint16_t addr = 0; addr<256; addr++)
+  {
+    if(addr == OPM_KEY_ON || regs[addr] == 0)
+      continue;
+    TEST_ASSERT_GREATER_THAN(w, reload.size());
+    TEST_ASSERT_EQUAL_HEX8(addr, reload[w].addr);
+    TEST_ASSERT_EQUAL_HEX8(regs[addr], reload[w].data);
+    w++;
+  }
+  TEST_ASSERT_EQUAL(w, reload.size());
+
+  //Playback picks up at the target, each write as far from it as in the track
+  size_t playFrom = rig.bus.writes.size();
+  rig.Play(44100);
+  size_t first = 0;
+  while(vgm.expected[first].sample < target)
+    first++;
+  TEST_ASSERT_GREATER_THAN(100, rig.bus.writes.size() - playFrom);
+  uint32_t offset = rig.bus.writes[playFrom].sample - vgm.expected[first].sample;
+  for(size_t i = playFrom; i<rig.bus.writes.size(); i++)
+  {
+    const LoggedWrite &e = vgm.expected[first + i - playFrom];
+    TEST_ASSERT_EQUAL_HEX8(e.addr, rig.bus.writes[i].addr);
+    TEST_ASSERT_EQUAL_HEX8(e.data, rig.bus.writes[i].data);
+    TEST_ASSERT_EQUAL_UINT32(e.sample + offset, rig.bus.writes[i].sample);
+  }
+}
+
+//A track change mid-seek drops the seek instead of finishing it over the new track
+static void test_track_change_cancels_seek()
+{
+  TestCard card;
+  VgmBuilder a, b;
+  uint32_t commandBytes;
+  card.Add("a.vgm", seekTrack(a, commandBytes));
+  card.Add("b.vgm", seekTrack(b, commandBytes));
+  TestRig rig(card.path);
+  rig.Begin();
+  rig.player->SetPlayMode(LOOP);
+  rig.Play(44100);
+  rig.serial.Send("s:5\n");
+  rig.player->Loop();
+  rig.player->Loop();
+  TEST_ASSERT_TRUE(rig.player->Seeking());
+  rig.serial.Send("+");
+  size_t from = rig.bus.writes.size();
+  rig.player->Loop();
+  TEST_ASSERT_FALSE(rig.player->Seeking());
+  rig.Play(44100);
+  //The new track plays from its start, with no reload of the seek's registers ahead of it
+  TEST_ASSERT_GREATER_THAN(100, rig.bus.writes.size() - from);
+  for(size_t i = from; i<rig.bus.writes.size(); i++)
+  {
+    TEST_ASSERT_EQUAL_HEX8(b.expected[i - from].addr, rig.bus.writes[i].addr);
+    TEST_ASSERT_EQUAL_HEX8(b.expected[i - from].data, rig.bus.writes[i].data);
+  }
+}
+
+//A name request that finds nothing mid-seek leaves the seek running, and it finishes as if never asked
+static void test_unknown_request_keeps_seek()
+{
+  TestCard card;
+  VgmBuilder vgm;
+  uint32_t commandBytes;
+  card.Add("seek.vgm", seekTrack(vgm, commandBytes));
+  TestRig rig(card.path);
+  rig.Begin();
+  rig.player->SetPlayMode(LOOP);
+  rig.Play(44100);
+  rig.serial.Send("s:3\n");
+  rig.player->Loop();
+  rig.player->Loop();
+  TEST_ASSERT_TRUE(rig.player->Seeking());
+  uint32_t resets = rig.bus.resets;
+  rig.serial.Send("r:missing.vgm\n");
+  uint32_t passes = 0;
+  while(rig.player->Seeking() && passes < 100000)
+  {
+    rig.player->Loop();
+    passes++;
+  }
+  TEST_ASSERT_FALSE(rig.player->Seeking());
+  TEST_ASSERT_EQUAL_UINT32(resets + 1, rig.bus.resets);
+
+  //Playback picks up at the target, right after the reload
+  size_t reloaded = rig.bus.writes.size();
+  uint32_t now = rig.timer.Now();
+  rig.Play(44100);
+  const uint32_t target = SEEK_SECONDS*44100;
+  size_t first = 0;
+  while(vgm.expected[first].sample < target)
+    first++;
+  TEST_ASSERT_GREATER_THAN(100, rig.bus.writes.size() - reloaded);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(now + vgm.expected[first].sample - target + SCHEDULE_AHEAD, rig.bus.writes[reloaded].sample);
+  for(size_t i = reloaded; i<rig.bus.writes.size(); i++)
+  {
+    TEST_ASSERT_EQUAL_HEX8(vgm.expected[first + i - reloaded].addr, rig.bus.writes[i].addr);
+    TEST_ASSERT_EQUAL_HEX8(vgm.expected[first + i - reloaded].data, rig.bus.writes[i].data);
+  }
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_seek_reloads_registers);
+  RUN_TEST(test_track_change_cancels_seek);
+  RUN_TEST(test_unknown_request_keeps_seek);
+  return UNITY_END();
+}
@@ -0,0 +1,143 @@
+//Serial commands fed the way they come off the wire: a byte per Loop() pass, or in random chunks with
+//lines split anywhere, CR and LF in separate reads and a line longer than the buffer. The tracks opened
+//show which commands went through and in what order
+#include <unity.h>
+#include <unistd.h>
+#include "../TestSupport.h"
+
+#define ALPHA 0 //Directory order of the tracks
+#define BETA 1
+#define CD 2
+#define GAMMA 3
+
+static uint32_t rng;
+
+static uint32_t nextRandom()
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+static std::vector<uint8_t> track()
+{
+  VgmBuilder vgm;
+  for(int i = 0; i<200; i++)
+  {
+    vgm.Write(0x28, i);
+    vgm.Wait(441);
+  }
+  return vgm.Finish();
+}
+
+static void fillCard(TestCard &card)
+{
+  card.Add("alpha.vgm", track());
+  card.Add("beta.vgm", track());
+  card.Add("c+d.vgm", track());
+  card.Add("gamma.vgm", track());
+}
+
+static const std::string longRequest = std::string(300, 'x');
+
+//Every command type, with a '+' inside an argument that must not change track, a line ended by CR alone
+//and a stray LF after a CR
+static std::string script()
+{
+  return std::string("+") + "-" + "r:gamma.vgm\r\n" + "r:c+d.vgm\r" + "r:" + longRequest + "\n" +
+    "v:12\r\n" + " r: beta.vgm \n" + "-";
+}
+
+static void checkDispatched(TestRig &rig)
+{
+  static const uint16_t expected[] = {ALPHA, BETA, ALPHA, GAMMA, CD, BETA, ALPHA};
+  TEST_ASSERT_EQUAL(sizeof(expected)/sizeof(expected[0]), rig.storage.opened.size());
+  for(size_t i = 0; i<rig.storage.opened.size(); i++)
+    TEST_ASSERT_EQUAL_UINT16(expected[i], rig.storage.opened[i]);
+
+  //The long line is cut to what the buffer holds and looked up as that
+  const std::string &out = rig.serial.output;
+  std::string cut = "REQUEST: " + longRequest.substr(0, SERIAL_LINE_SIZE-3) + "\n";
+  TEST_ASSERT_TRUE(out.find(cut) != std::string::npos);
+  size_t found = 0, missing = 0;
+  for(size_t at = 0; (at = out.find("File found!", at)) != std::string::npos; at++)
+    found++;
+  for(size_t at = 0; (at = out.find("File not found!", at)) != std::string::npos; at++)
+    missing++;
+  TEST_ASSERT_EQUAL(3, found);
+  TEST_ASSERT_EQUAL(1, missing);
+}
+
+//Loop until everything released has been read. SERIAL_BYTES_PER_LOOP caps what one pass takes
+static void drain(TestRig &rig)
+{
+  while(rig.serial.pos < rig.serial.arrived)
+    rig.player->Loop();
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_byte_at_a_time()
+{
+  TestCard card;
+  fillCard(card);
+  TestRig rig(card.path);
+  rig.Begin();
+  rig.serial.Queue(script());
+  while(rig.serial.arrived < rig.serial.input.size())
+  {
+    rig.serial.Arrive(1);
+    rig.player->Loop();
+  }
+  drain(rig);
+  checkDispatched(rig);
+}
+
+static void test_random_chunks()
+{
+  for(uint32_t seed = 1; seed <= 50; seed++)
+  {
+    rng = seed * 2654435761UL;
+    TestCard card;
+    fillCard(card);
+    TestRig rig(card.path);
+    rig.Begin();
+    rig.serial.Queue(script());
+    while(rig.serial.arrived < rig.serial.input.size())
+    {
+      rig.serial.Arrive(1 + nextRandom() % 40);
+      for(uint32_t passes = nextRandom() % 3; passes > 0; passes--)
+        rig.player->Loop();
+    }
+    drain(rig);
+    checkDispatched(rig);
+  }
+}
+
+//A line with no CR or LF runs once input has paused for the timeout, and not before
+static void test_line_timeout()
+{
+  TestCard card;
+  fillCard(card);
+  TestRig rig(card.path);
+  rig.Begin();
+  rig.serial.Send("r:gamma.vgm");
+  drain(rig);
+  rig.player->Loop();
+  TEST_ASSERT_EQUAL(1, rig.storage.opened.size());
+  usleep(SERIAL_LINE_TIMEOUT_US + SERIAL_LINE_TIMEOUT_US/2);
+  rig.player->Loop();
+  TEST_ASSERT_EQUAL(2, rig.storage.opened.size());
+  TEST_ASSERT_EQUAL_UINT16(GAMMA, rig.storage.opened[1]);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_byte_at_a_time);
+  RUN_TEST(test_random_chunks);
+  RUN_TEST(test_line_timeout);
+  return UNITY_END();
+}
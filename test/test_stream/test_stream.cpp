@@ -0,0 +1,277 @@
+//Starting and ending serial streams. Only a whole, valid STREAM_OPEN may take the player off the card,
+//and a stream must not outlive a host that has gone quiet or a track picked on the board
+#include <unity.h>
+#include <unistd.h>
+#include "../TestSupport.h"
+#include "OPMStream.h"
+
+static std::string frame(uint8_t type, const std::vector<uint8_t> &payload)
+{
+  std::string f;
+  f += (char)STREAM_SYNC;
+  f += (char)type;
+  f += (char)payload.size();
+  uint8_t check = type + payload.size();
+  for(size_t i = 0; i<payload.size(); i++)
+  {
+    f += (char)payload[i];
+    check += payload[i];
+  }
+  f += (char)(uint8_t)-check;
+  return f;
+}
+
+static std::string openFrame(uint8_t version = STREAM_VERSION, uint32_t magic = STREAM_MAGIC)
+{
+  uint32_t clock = 3579545;
+  std::vector<uint8_t> p;
+  for(int i = 0; i<4; i++)
+    p.push_back(magic >> (i*8));
+  p.push_back(version);
+  for(int i = 0; i<4; i++)
+    p.push_back(clock >> (i*8));
+  return frame(STREAM_OPEN, p);
+}
+
+//Types of the frames the board sent, skipping the text printed between them
+static std::string boardFrames(const std::string &out, std::vector<uint8_t> *errors = NULL)
+{
+  std::string types;
+  for(size_t i = 0; i + 3 < out.size(); i++)
+  {
+    if((uint8_t)out[i] != STREAM_SYNC)
+      continue;
+    uint8_t length = out[i+2];
+    if(i + 4 + length > out.size())
+      break;
+    uint8_t check = 0;
+    for(size_t b = i+1; b < i + 4 + length; b++)
+      check += out[b];
+    if(check != 0)
+      continue;
+    types += out[i+1];
+    if(errors && out[i+1] == STREAM_ERROR)
+      errors->push_back(out[i+3]);
+    i += 3 + length;
+  }
+  return types;
+}
+
+static std::vector<uint8_t> track()
+{
+  VgmBuilder vgm;
+  for(int i = 0; i<200; i++)
+  {
+    vgm.Write(0x28, i);
+    vgm.Wait(441);
+  }
+  return vgm.Finish();
+}
+
+static void run(TestRig &rig, int passes)
+{
+  for(int i = 0; i<passes; i++)
+    rig.Step();
+}
+
+void setUp() {}
+void tearDown() {}
+
+//A sync byte in the middle of ordinary input is dropped and what follows still works as commands
+static void test_stray_sync_is_ignored()
+{
+  TestCard card;
+  card.Add("a.vgm", track());
+  card.Add("b.vgm", track());
+  TestRig rig(card.path);
+  rig.Begin();
+  rig.serial.Send(std::string(1, (char)STREAM_SYNC) + "+");
+  run(rig, 10);
+  TEST_ASSERT_FALSE(rig.player->Streaming());
+  TEST_ASSERT_EQUAL(2, rig.storage.opened.size());
+  TEST_ASSERT_EQUAL_UINT16(1, rig.storage.opened[1]);
+
+  //Sync and type right, rest of the frame wrong
+  rig.serial.Send(openFrame(STREAM_VERSION, 0x12345678));
+  std::string bad = openFrame();
+  bad[bad.size()-1] ^= 1;
+  rig.serial.Send(bad);
+  run(rig, 10);
+  TEST_ASSERT_FALSE(rig.player->Streaming());
+  TEST_ASSERT_EQUAL_STRING("", boardFrames(rig.serial.output).c_str());
+
+  //A sync byte followed by nothing is let go once input pauses
+  rig.serial.Send(std::string(1, (char)STREAM_SYNC));
+  run(rig, 2);
+  usleep(SERIAL_LINE_TIMEOUT_US + SERIAL_LINE_TIMEOUT_US/2);
+  rig.serial.Send("-");
+  run(rig, 10);
+  TEST_ASSERT_EQUAL(3, rig.storage.opened.size());
+  TEST_ASSERT_EQUAL_UINT16(0, rig.storage.opened[2]);
+}
+
+static void test_handshake()
+{
+  TestCard card;
+  card.Add("a.vgm", track());
+  TestRig rig(card.path);
+  rig.Begin();
+  rig.serial.Send(openFrame(STREAM_VERSION + 1));
+  run(rig, 10);
+  TEST_ASSERT_FALSE(rig.player->Streaming());
+  std::vector<uint8_t> errors;
+  TEST_ASSERT_EQUAL_STRING("X", boardFrames(rig.serial.output, &errors).c_str());
+  TEST_ASSERT_EQUAL(STREAM_ERR_VERSION, errors[0]);
+
+  //Split over several reads
+  rig.serial.output.clear();
+  rig.serial.Queue(openFrame());
+  while(rig.serial.arrived < rig.serial.input.size())
+  {
+    rig.serial.Arrive(3);
+    rig.Step();
+  }
+  rig.Step();
+  TEST_ASSERT_TRUE(rig.player->Streaming());
+  TEST_ASSERT_EQUAL_STRING("K", boardFrames(rig.serial.output).c_str());
+
+  std::vector<uint8_t> data;
+  for(int i = 0; i<STREAM_MAX_PAYLOAD/4; i++)
+  {
+    data.push_back(0x28);
+    data.push_back(i);
+    data.push_back(OPM_WAIT8);
+    data.push_back(100);
+  }
+  rig.serial.Send(frame(STREAM_DATA, data) + frame(STREAM_CLOSE, std::vector<uint8_t>()));
+  rig.Play(44100);
+  TEST_ASSERT_FALSE(rig.player->Streaming());
+  TEST_ASSERT_EQUAL_STRING("KE", boardFrames(rig.serial.output).c_str());
+}
+
+//A host that stops sending, without closing, loses the stream once what it sent has played
+static void test_idle_host_times_out()
+{
+  TestCard card;
+  card.Add("a.vgm", track());
+  TestRig rig(card.path);
+  rig.Begin();
+  rig.serial.Send(openFrame());
+  run(rig, 5);
+  TEST_ASSERT_TRUE(rig.player->Streaming());
+  usleep(STREAM_IDLE_TIMEOUT_US / 2);
+  run(rig, 5);
+  TEST_ASSERT_TRUE(rig.player->Streaming());
+  usleep(STREAM_IDLE_TIMEOUT_US / 2 + STREAM_IDLE_TIMEOUT_US / 4);
+  run(rig, 5);
+  TEST_ASSERT_FALSE(rig.player->Streaming());
+  std::vector<uint8_t> errors;
+  TEST_ASSERT_EQUAL_STRING("KX", boardFrames(rig.serial.output, &errors).c_str());
+  TEST_ASSERT_EQUAL(STREAM_ERR_TIMEOUT, errors[0]);
+}
+
+//Picking a track on the board, as the buttons do, ends the stream and tells the host
+static void test_track_change_stops_stream()
+{
+  TestCard card;
+  card.Add("a.vgm", track());
+  TestRig rig(card.path);
+  rig.Begin();
+  rig.serial.Send(openFrame());
+  run(rig, 5);
+  TEST_ASSERT_TRUE(rig.player->Streaming());
+  TEST_ASSERT_TRUE(rig.player->ChangeTrack(NEXT));
+  TEST_ASSERT_FALSE(rig.player->Streaming());
+  std::vector<uint8_t> errors;
+  TEST_ASSERT_EQUAL_STRING("KX", boardFrames(rig.serial.output, &errors).c_str());
+  TEST_ASSERT_EQUAL(STREAM_ERR_STOPPED, errors[0]);
+  size_t from = rig.bus.writes.size();
+  rig.Play(44100);
+  TEST_ASSERT_GREATER_THAN(50, rig.bus.writes.size() - from);
+}
+
+//After a stream has ended the card file left open is not played, not even by a request that finds nothing
+static void test_ended_stream_stays_idle()
+{
+  TestCard card;
+  VgmBuilder vgm;
+  for(int i = 0; i<200; i++)
+  {
+    vgm.Write(0x28, i);
+    vgm.Wait(441);
+  }
+  card.Add("a.vgm", vgm.Finish());
+  TestRig rig(card.path);
+  rig.Begin();
+  rig.serial.Send(openFrame());
+  run(rig, 5);
+  std::vector<uint8_t> data;
+  for(int i = 0; i<STREAM_MAX_PAYLOAD/4; i++)
+  {
+    data.push_back(0x08);
+    data.push_back(i & 7);
+    data.push_back(OPM_WAIT8);
+    data.push_back(100);
+  }
+  rig.serial.Send(frame(STREAM_DATA, data) + frame(STREAM_CLOSE, std::vector<uint8_t>()));
+  rig.Play(44100);
+  TEST_ASSERT_FALSE(rig.player->Streaming());
+  TEST_ASSERT_EQUAL_STRING("KE", boardFrames(rig.serial.output).c_str());
+
+  size_t from = rig.bus.writes.size();
+  uint32_t resets = rig.bus.resets;
+  rig.serial.Send("r:missing.vgm\n");
+  rig.Play(44100);
+  TEST_ASSERT_EQUAL(from, rig.bus.writes.size());
+  TEST_ASSERT_EQUAL_UINT32(resets, rig.bus.resets);
+
+  //A track that is there plays from its start
+  rig.serial.Send("r:a.vgm\n");
+  rig.Play(44100);
+  TEST_ASSERT_GREATER_THAN(50, rig.bus.writes.size() - from);
+  for(size_t i = from; i<rig.bus.writes.size(); i++)
+  {
+    TEST_ASSERT_EQUAL_HEX8(vgm.expected[i - from].addr, rig.bus.writes[i].addr);
+    TEST_ASSERT_EQUAL_HEX8(vgm.expected[i - from].data, rig.bus.writes[i].data);
+  }
+}
+
+//Writes with no wait among them, a patch load say, are played and the stream ends once the host closes it
+static void test_writes_only_stream_plays()
+{
+  TestCard card;
+  card.Add("a.vgm", track());
+  TestRig rig(card.path);
+  rig.Begin();
+  rig.serial.Send(openFrame());
+  run(rig, 5);
+  size_t from = rig.bus.writes.size();
+  std::vector<uint8_t> data;
+  for(int i = 0; i<STREAM_MAX_PAYLOAD/2; i++)
+  {
+    data.push_back(0x40 + i);
+    data.push_back(i);
+  }
+  rig.serial.Send(frame(STREAM_DATA, data) + frame(STREAM_CLOSE, std::vector<uint8_t>()));
+  rig.Play(4410);
+  TEST_ASSERT_FALSE(rig.player->Streaming());
+  TEST_ASSERT_EQUAL_STRING("KE", boardFrames(rig.serial.output).c_str());
+  TEST_ASSERT_EQUAL(STREAM_MAX_PAYLOAD/2, rig.bus.writes.size() - from);
+  for(int i = 0; i<STREAM_MAX_PAYLOAD/2; i++)
+  {
+    TEST_ASSERT_EQUAL_HEX8(0x40 + i, rig.bus.writes[from + i].addr);
+    TEST_ASSERT_EQUAL_HEX8(i, rig.bus.writes[from + i].data);
+  }
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_stray_sync_is_ignored);
+  RUN_TEST(test_handshake);
+  RUN_TEST(test_idle_host_times_out);
+  RUN_TEST(test_track_change_stops_stream);
+  RUN_TEST(test_ended_stream_stays_idle);
+  RUN_TEST(test_writes_only_stream_plays);
+  return UNITY_END();
+}
@@ -0,0 +1,180 @@
+//Timing error of every register write against the ideal VGM timeline. Writes go out from the tick ISR,
+//so stalls in the main loop and a slow card must not move them. The only lateness allowed is the chip's
+//own: while it is busy after a write the next one waits, so a burst on one sample spreads over the
+//following ticks. Each scenario prints how the writes landed
+#include <unity.h>
+#include "../TestSupport.h"
+
+#define TIMING_TRACKS 4
+#define TIMING_COMMANDS 3000
+
+static uint32_t rng;
+
+static uint32_t nextRandom()
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+//Bursts on one sample as key ons and patch loads make them, short and long waits, now and then a data block
+static std::vector<uint8_t> timingTrack(VgmBuilder &vgm)
+{
+  for(int i = 0; i<TIMING_COMMANDS; i++)
+  {
+    uint32_t r = nextRandom() % 100;
+    if(r < 60)
+    {
+      for(int b = 1 + nextRandom() % 12; b > 0; b--)
+        vgm.Write(0x08 + nextRandom() % 0xF8, nextRandom());
+      vgm.Wait(1 + nextRandom() % 40);
+    }
+    else if(r < 97)
+      vgm.Wait(nextRandom() % 1500);
+    else
+      vgm.DataBlock(nextRandom() % 4 ? nextRandom() % 600 : 8192 + nextRandom() % 20000);
+  }
+  return vgm.Finish();
+}
+
+struct Scenario
+{
+  const char *name;
+  uint32_t busyTicks; //Ticks the chip stays busy after a write
+  uint32_t stall; //Most samples one main loop pass may take, 0 to keep the clock half the lead behind
+  uint32_t blockSamples; //Card read time per block, read in the background
+};
+
+//Samples late against the timeline, and against the timeline the chip's busy period allows
+struct TimingError
+{
+  uint32_t writes;
+  uint32_t worst;
+  uint64_t total;
+  uint32_t worstOverChip; //Lateness the chip's busy period doesn't explain. Must stay 0
+  uint32_t histogram[LATENESS_BUCKETS];
+};
+
+//The timeline starts on the first write, so the card time spent opening the track doesn't count. Nothing is
+//queued before it, so it can't have been held up by the chip
+static void measure(TimingError &error, const std::vector<LoggedWrite> &expected, const std::vector<LoggedWrite> &got, uint32_t busyTicks)
+{
+  TEST_ASSERT_GREATER_OR_EQUAL(expected.size(), got.size());
+  uint32_t start = got[0].sample - expected[0].sample;
+  uint32_t chipFree = 0; //First tick the chip takes a write again
+  for(size_t i = 0; i<expected.size(); i++)
+  {
+    TEST_ASSERT_EQUAL_HEX32(expected[i].addr, got[i].addr);
+    TEST_ASSERT_EQUAL_HEX32(expected[i].data, got[i].data);
+    uint32_t due = expected[i].sample + start;
+    uint32_t ideal = i > 0 && int32_t(chipFree - due) > 0 ? chipFree : due;
+    chipFree = ideal + busyTicks;
+    TEST_ASSERT_GREATER_OR_EQUAL(due, got[i].sample);
+    uint32_t late = got[i].sample - due;
+    uint32_t overChip = got[i].sample - ideal;
+    if(late > error.worst)
+      error.worst = late;
+    if(overChip > error.worstOverChip)
+      error.worstOverChip = overChip;
+    error.total += late;
+    uint8_t bucket = 0;
+    while(bucket < LATENESS_BUCKETS-1 && late >= (1U << bucket))
+      bucket++;
+    error.histogram[bucket]++;
+    error.writes++;
+  }
+}
+
+static void play(const Scenario &scenario, TimingError &error)
+{
+  TestCard card;
+  VgmBuilder vgm;
+  card.Add("timing.vgm", timingTrack(vgm));
+  TestRig rig(card.path);
+  rig.bus.busyTicks = scenario.busyTicks;
+  if(scenario.blockSamples)
+    rig.storage.SetLatency(&rig.timer, scenario.blockSamples, true);
+  rig.Begin();
+  rig.player->SetPlayMode(LOOP);
+  uint32_t end = rig.timer.Now() + vgm.samples + 44100;
+  while(rig.player->LoopCount() < 1 && int32_t(end - rig.timer.Now()) > 0)
+  {
+    if(scenario.stall == 0)
+      rig.Step();
+    else
+    {
+      //A pass busy with the display or the serial port takes a while before the next one comes round
+      rig.player->Loop();
+      rig.timer.Run(1 + nextRandom() % scenario.stall);
+    }
+  }
+  TEST_ASSERT_EQUAL(1, rig.player->LoopCount());
+  rig.Play(2*SCHEDULE_AHEAD);
+  TEST_ASSERT_EQUAL_UINT32(0, rig.player->Stats().QueueUnderruns());
+  if(!scenario.blockSamples) //Opened in no time, so the timeline starts with the first tick, which plays sample 0
+    TEST_ASSERT_EQUAL_UINT32(vgm.expected[0].sample + 1, rig.bus.writes[0].sample);
+  measure(error, vgm.expected, rig.bus.writes, scenario.busyTicks);
+}
+
+static TimingError runScenario(const Scenario &scenario)
+{
+  TimingError error;
+  memset(&error, 0, sizeof(error));
+  for(uint32_t seed = 1; seed <= TIMING_TRACKS; seed++)
+  {
+    rng = seed * 2654435761UL;
+    play(scenario, error);
+  }
+  char line[200];
+  int n = snprintf(line, sizeof(line), "%s: %u writes, worst %u samples late, mean %.3f, beyond the chip %u. Late 0/1/2-3/4-7..:",
+    scenario.name, (unsigned)error.writes, (unsigned)error.worst, (double)error.total / error.writes, (unsigned)error.worstOverChip);
+  for(int b = 0; b<LATENESS_BUCKETS && n < (int)sizeof(line); b++)
+    n += snprintf(line + n, sizeof(line) - n, " %u", (unsigned)error.histogram[b]);
+  TEST_MESSAGE(line);
+  return error;
+}
+
+void setUp() {}
+void tearDown() {}
+
+//A chip that is never busy gets every write on its sample
+static void test_writes_land_on_their_sample()
+{
+  const Scenario scenarios[] = {
+    {"steady loop", 0, 0, 0},
+    {"loop stalls up to 10mS", 0, 441, 0},
+    {"card at 4.5mS a block", 0, 0, 200},
+    {"loop stalls and slow card", 0, 441, 200},
+  };
+  for(size_t s = 0; s<sizeof(scenarios)/sizeof(scenarios[0]); s++)
+  {
+    TimingError error = runScenario(scenarios[s]);
+    TEST_ASSERT_EQUAL_UINT32(0, error.worst);
+  }
+}
+
+//With the chip busy for a tick or two after each write, bursts spread out but nothing is later than the
+//chip makes it
+static void test_only_the_chip_delays_writes()
+{
+  const Scenario scenarios[] = {
+    {"chip busy 1 tick", 1, 0, 0},
+    {"chip busy 1 tick, loop stalls and slow card", 1, 441, 200},
+    {"chip busy 2 ticks, loop stalls and slow card", 2, 441, 200},
+  };
+  for(size_t s = 0; s<sizeof(scenarios)/sizeof(scenarios[0]); s++)
+  {
+    TimingError error = runScenario(scenarios[s]);
+    TEST_ASSERT_EQUAL_UINT32(0, error.worstOverChip);
+    TEST_ASSERT_GREATER_THAN(0, error.worst);
+  }
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_writes_land_on_their_sample);
+  RUN_TEST(test_only_the_chip_delays_writes);
+  return UNITY_END();
+}
@@ -0,0 +1,168 @@
+//Changing track on cards of 10, 500 and 5000 files. The directory is walked once in Begin(), after that
+//every change to an indexed track goes straight to its entry, so the card work per change must not grow
+//with the number of files. Tracks past the index are still reached, by number or by name, by walking the
+//directory. The time per change is printed for each card size
+#include <unity.h>
+#include <chrono>
+#include "../TestSupport.h"
+
+//Counts the directory calls the player makes
+class CountingStorage : public LogStorage
+{
+public:
+  uint32_t walks;
+  uint32_t entries;
+  uint32_t names;
+  CountingStorage(const char *root) : LogStorage(root), walks(0), entries(0), names(0) {}
+  void Rewind() {walks++; LogStorage::Rewind();}
+  bool NextEntry(uint16_t &dirIndex, char *name, size_t size) {entries++; return LogStorage::NextEntry(dirIndex, name, size);}
+  bool EntryName(uint16_t dirIndex, char *name, size_t size) {names++; return LogStorage::EntryName(dirIndex, name, size);}
+  void Name(char *name, size_t size) {uint32_t n = names; LogStorage::Name(name, size); names = n;} //The open track's own name isn't a lookup
+  void Clear() {walks = 0; entries = 0; names = 0;}
+};
+
+struct ChangeCost
+{
+  uint32_t entries; //NextEntry() calls over all the changes
+  uint32_t walks;
+  uint32_t names; //EntryName() calls, name requests only
+  double microseconds; //Mean time per change
+  double walkMicroseconds; //Mean time per change to a track past the index
+  double walkEntries; //Mean NextEntry() calls per change to a track past the index
+};
+
+static std::string trackName(uint32_t i)
+{
+  char name[16];
+  snprintf(name, sizeof(name), "t%04u.vgm", (unsigned)i);
+  return name;
+}
+
+static void fillCard(TestCard &card, uint32_t files)
+{
+  VgmBuilder vgm;
+  for(int i = 0; i<32; i++)
+  {
+    vgm.Write(0x20 + (i & 7), i);
+    vgm.Wait(100);
+  }
+  std::vector<uint8_t> data = vgm.Finish();
+  for(uint32_t i = 0; i<files; i++)
+    card.Add(trackName(i), data);
+}
+
+static double elapsed(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+static ChangeCost changeTracks(uint32_t files)
+{
+  TestCard card;
+  fillCard(card, files);
+  CountingStorage storage(card.path.c_str());
+  TEST_ASSERT_TRUE(storage.Begin());
+  HostTimer timer;
+  LogBus bus(timer);
+  QuietDisplay display;
+  ScriptSerial serial;
+  Player player(storage, bus, timer, display, serial);
+  testPlayer = &player;
+  player.Begin(testTick);
+
+  //Begin() reads each entry once, counting the ones past the index limit too
+  uint32_t indexed = files < MAX_INDEXED_FILES ? files : MAX_INDEXED_FILES;
+  TEST_ASSERT_EQUAL_UINT32(files + 1, storage.entries);
+  TEST_ASSERT_EQUAL_UINT32(0, storage.opened.back());
+
+  ChangeCost cost = {0, 0, 0, 0, 0, 0};
+  storage.Clear();
+  const int rounds = 200;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for(int i = 0; i<rounds; i++)
+  {
+    TEST_ASSERT_TRUE(player.ChangeTrack(NEXT));
+    TEST_ASSERT_EQUAL_UINT32(1, storage.opened.back());
+    TEST_ASSERT_TRUE(player.ChangeTrack(FIRST_START));
+    TEST_ASSERT_EQUAL_UINT32(0, storage.opened.back());
+  }
+  cost.entries = storage.entries;
+  cost.walks = storage.walks;
+  uint32_t names = storage.names;
+  for(int i = 0; i<rounds; i++)
+  {
+    uint32_t want = (i * 37) % indexed;
+    TEST_ASSERT_TRUE(player.ChangeTrack(REQUEST, trackName(want).c_str()));
+    TEST_ASSERT_EQUAL_UINT32(want, storage.opened.back());
+  }
+  cost.microseconds = elapsed(start) / (3*rounds);
+  cost.names = storage.names - names;
+  cost.entries += storage.entries;
+  cost.walks += storage.walks;
+
+  //Every track on the card can be reached. PREV off the first wraps to the last, shuffle picks from all of them
+  storage.Clear();
+  player.ChangeTrack(FIRST_START);
+  uint32_t walked = 0;
+  start = std::chrono::steady_clock::now();
+  TEST_ASSERT_TRUE(player.ChangeTrack(PREV));
+  TEST_ASSERT_EQUAL_UINT32(files - 1, storage.opened.back());
+  walked += storage.opened.back() >= MAX_INDEXED_FILES;
+  TEST_ASSERT_TRUE(player.ChangeTrack(NEXT));
+  TEST_ASSERT_EQUAL_UINT32(0, storage.opened.back());
+  for(int i = 0; i<rounds; i++)
+  {
+    TEST_ASSERT_TRUE(player.ChangeTrack(RND));
+    TEST_ASSERT_LESS_THAN(files, storage.opened.back());
+    walked += storage.opened.back() >= MAX_INDEXED_FILES;
+  }
+  double past = elapsed(start);
+  if(files > MAX_INDEXED_FILES)
+  {
+    //Only the tracks past the index walk the directory, at most once each
+    TEST_ASSERT_GREATER_THAN(rounds / 4, walked);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(walked, storage.walks);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(walked * files, storage.entries);
+    cost.walkMicroseconds = past / walked;
+    cost.walkEntries = (double)storage.entries / walked;
+  }
+  else
+    TEST_ASSERT_EQUAL_UINT32(0, storage.walks + storage.entries);
+
+  //Names past the index are found by one walk, which also serves to open the track
+  storage.Clear();
+  TEST_ASSERT_TRUE(player.ChangeTrack(REQUEST, trackName(files - 1).c_str()));
+  TEST_ASSERT_EQUAL_UINT32(files - 1, storage.opened.back());
+  TEST_ASSERT_EQUAL_UINT32(files > MAX_INDEXED_FILES ? 1 : 0, storage.walks);
+  TEST_ASSERT_FALSE(player.ChangeTrack(REQUEST, "missing.vgm"));
+  TEST_ASSERT_EQUAL_UINT32(files - 1, storage.opened.back());
+
+  char line[160];
+  snprintf(line, sizeof(line), "%u files: %.1f uS per change, %u name reads over %d requests. Past the index %.1f uS and %.0f entries read per change",
+    (unsigned)files, cost.microseconds, (unsigned)cost.names, rounds, cost.walkMicroseconds, cost.walkEntries);
+  TEST_MESSAGE(line);
+  return cost;
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_change_cost_does_not_grow_with_the_card()
+{
+  ChangeCost small = changeTracks(10);
+  ChangeCost medium = changeTracks(500);
+  ChangeCost large = changeTracks(5000);
+  TEST_ASSERT_EQUAL_UINT32(0, small.entries + medium.entries + large.entries);
+  TEST_ASSERT_EQUAL_UINT32(0, small.walks + medium.walks + large.walks);
+  //A name request only reads the names that share its hash tag, nearly always just the one asked for
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(250, small.names);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(250, medium.names);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(250, large.names);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_change_cost_does_not_grow_with_the_card);
+  return UNITY_END();
+}
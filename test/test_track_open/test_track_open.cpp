@@ -0,0 +1,194 @@
+//Opening a track: header decode and what happens on the buses before the first write
+#include <unity.h>
+#include "../TestSupport.h"
+#include "OPMStream.h"
+
+//The card's SPI bus as the LTC6903 sees it. Reads leave a multi-block read streaming with CS low,
+//Seek() and Release() end it
+class SharedBusStorage : public DirStorage
+{
+public:
+  bool selected;
+  SharedBusStorage(const char *root) : DirStorage(root), selected(false) {}
+  int Read(void *dst, uint32_t count) {selected = true; return DirStorage::Read(dst, count);}
+  bool BeginRead(void *dst, uint32_t count) {selected = true; return DirStorage::BeginRead(dst, count);}
+  bool Seek(uint32_t pos) {selected = false; return DirStorage::Seek(pos);}
+  void Release() {selected = false;}
+};
+
+//Fails the test if the clock is programmed while the card still holds the bus
+class ClockBus : public LogBus
+{
+public:
+  SharedBusStorage &storage;
+  uint32_t clocksSet;
+  bool clashed;
+  ClockBus(const HostTimer &timer, SharedBusStorage &s) : LogBus(timer), storage(s), clocksSet(0), clashed(false) {}
+  void SetClock(uint32_t hz)
+  {
+    clashed |= storage.selected;
+    clocksSet++;
+    LogBus::SetClock(hz);
+  }
+};
+
+void setUp() {}
+void tearDown() {}
+
+static void putWord(uint8_t *raw, uint32_t offset, uint32_t value)
+{
+  for(int i = 0; i<4; i++)
+    raw[offset+i] = value >> (i*8);
+}
+
+//A 1.71 header with a different value in every field, laid out as in the VGM 1.71 spec
+static void buildHeader171(uint8_t *raw)
+{
+  memset(raw, 0, VGM_HEADER_SIZE);
+  memcpy(raw, "Vgm ", 4);
+  putWord(raw, 0x04, 0x00012340);
+  putWord(raw, 0x08, 0x171);
+  putWord(raw, 0x14, 0x00012000); //GD3, relative
+  putWord(raw, 0x18, 1234567);
+  putWord(raw, 0x1C, 0x00000200); //Loop, relative
+  putWord(raw, 0x20, 765432);
+  putWord(raw, 0x24, 60);
+  putWord(raw, 0x30, 4000000); //YM2151
+  putWord(raw, 0x34, 0x100 - 0x34);
+  putWord(raw, 0x5C, 14318180); //YMF262
+  putWord(raw, 0x60, 33868800); //YMF278B
+  putWord(raw, 0x64, 16934400); //YMF271
+  putWord(raw, 0x68, 16934401); //YMZ280B
+  putWord(raw, 0x6C, 12500000); //RF5C164
+  putWord(raw, 0x70, 23011361); //PWM
+  putWord(raw, 0x74, 1789750); //AY8910
+  putWord(raw, 0x78, 0x00010110); //AY8910 type and flags
+  putWord(raw, 0x7C, 0x00000A05); //Volume modifier, loop base and modifier
+  putWord(raw, 0x80, 4194304); //GB DMG
+  putWord(raw, 0xB8, 22579200); //SCSP
+  putWord(raw, 0xBC, 0); //Extra header offset
+  putWord(raw, 0xC8, 8000000); //SAA1099
+}
+
+static void test_header_171_fields()
+{
+  uint8_t raw[VGM_HEADER_SIZE];
+  buildHeader171(raw);
+  VGMHeader header;
+  TEST_ASSERT_FALSE(Player::DecodeHeader(header, raw, sizeof(raw)));
+  TEST_ASSERT_EQUAL_HEX32(0x171, header.version);
+  TEST_ASSERT_EQUAL_HEX32(0x00012340, header.EoF);
+  TEST_ASSERT_EQUAL_HEX32(0x00012014, header.gd3Offset);
+  TEST_ASSERT_EQUAL_HEX32(0x0000021C, header.loopOffset);
+  TEST_ASSERT_EQUAL_HEX32(0x100, header.vgmDataOffset);
+  TEST_ASSERT_EQUAL(1234567, header.totalSamples);
+  TEST_ASSERT_EQUAL(765432, header.loopNumSamples);
+  TEST_ASSERT_EQUAL(60, header.rate);
+  TEST_ASSERT_EQUAL(4000000, header.ym2151Clock);
+  TEST_ASSERT_EQUAL(14318180, header.ymf262clock);
+  TEST_ASSERT_EQUAL(33868800, header.ymf278bclock);
+  TEST_ASSERT_EQUAL(16934400, header.ymf271clock);
+  TEST_ASSERT_EQUAL(16934401, header.ymz280Bclock);
+  TEST_ASSERT_EQUAL(12500000, header.rf5C164clock);
+  TEST_ASSERT_EQUAL(23011361, header.pwmclock);
+  TEST_ASSERT_EQUAL(1789750, header.ay8910clock);
+  TEST_ASSERT_EQUAL_HEX32(0x00010110, header.ayclockflags);
+  TEST_ASSERT_EQUAL_HEX32(0x00000A05, header.vmlblm);
+  TEST_ASSERT_EQUAL(4194304, header.gbdgmclock);
+  TEST_ASSERT_EQUAL(22579200, header.scspclock);
+  TEST_ASSERT_EQUAL(8000000, header.saa1099clock);
+}
+
+//Fields newer than the version, and anything at or past the command data, read as zero
+static void test_header_version_and_data_start()
+{
+  uint8_t raw[VGM_HEADER_SIZE];
+  buildHeader171(raw);
+  putWord(raw, 0x08, 0x150);
+  putWord(raw, 0x34, 0x0C);
+  VGMHeader header;
+  Player::DecodeHeader(header, raw, sizeof(raw));
+  TEST_ASSERT_EQUAL_HEX32(0x40, header.vgmDataOffset);
+  TEST_ASSERT_EQUAL(4000000, header.ym2151Clock);
+  TEST_ASSERT_EQUAL(0, header.ymf262clock);
+  TEST_ASSERT_EQUAL(0, header.ymf278bclock);
+  TEST_ASSERT_EQUAL(0, header.ay8910clock);
+
+  //1.61 with the data at 0x100 has the 1.51 and 1.60 fields but not the 1.71 ones
+  buildHeader171(raw);
+  putWord(raw, 0x08, 0x161);
+  Player::DecodeHeader(header, raw, sizeof(raw));
+  TEST_ASSERT_EQUAL(33868800, header.ymf278bclock);
+  TEST_ASSERT_EQUAL_HEX32(0x00000A05, header.vmlblm);
+  TEST_ASSERT_EQUAL(4194304, header.gbdgmclock);
+  TEST_ASSERT_EQUAL(0, header.scspclock);
+  TEST_ASSERT_EQUAL(0, header.saa1099clock);
+
+  //Before 1.10 the YM2413 clock stood for the YM2151 too, and a short read leaves the rest zero
+  memset(raw, 0, sizeof(raw));
+  memcpy(raw, "Vgm ", 4);
+  putWord(raw, 0x08, 0x101);
+  putWord(raw, 0x10, 3579545);
+  putWord(raw, 0x30, 1);
+  Player::DecodeHeader(header, raw, 0x28);
+  TEST_ASSERT_EQUAL(3579545, header.ym2151Clock);
+  TEST_ASSERT_EQUAL_HEX32(0x40, header.loopOffset);
+  TEST_ASSERT_EQUAL(0, header.gd3Offset);
+}
+
+static void test_header_opm_stream()
+{
+  uint8_t raw[VGM_HEADER_SIZE];
+  memset(raw, 0, sizeof(raw));
+  putWord(raw, 0x00, OPM_IDENT);
+  putWord(raw, 0x04, 0x1000);
+  putWord(raw, 0x0C, 3579545);
+  putWord(raw, 0x10, 44100);
+  putWord(raw, 0x1C, OPM_HEADER_SIZE);
+  VGMHeader header;
+  TEST_ASSERT_TRUE(Player::DecodeHeader(header, raw, sizeof(raw)));
+  TEST_ASSERT_EQUAL(3579545, header.ym2151Clock);
+  TEST_ASSERT_EQUAL(44100, header.totalSamples);
+  TEST_ASSERT_EQUAL(OPM_HEADER_SIZE, header.vgmDataOffset);
+  TEST_ASSERT_EQUAL(OPM_HEADER_SIZE, header.loopOffset);
+}
+
+static void test_clock_is_set_with_the_card_released()
+{
+  TestCard card;
+  for(int t = 0; t<3; t++)
+  {
+    VgmBuilder vgm(0x151, 3579545 + t*1000);
+    for(int i = 0; i<5000; i++)
+    {
+      vgm.Write(0x20 + (i & 7), i);
+      vgm.Wait(10);
+    }
+    card.Add(std::string("t") + char('0' + t) + ".vgm", vgm.Finish());
+  }
+  SharedBusStorage storage(card.path.c_str());
+  TEST_ASSERT_TRUE(storage.Begin());
+  HostTimer timer;
+  ClockBus bus(timer, storage);
+  QuietDisplay display;
+  ScriptSerial serial;
+  Player player(storage, bus, timer, display, serial);
+  testPlayer = &player;
+  player.Begin(testTick);
+  TEST_ASSERT_EQUAL(3579545, bus.clock);
+  TEST_ASSERT_TRUE(player.ChangeTrack(NEXT));
+  TEST_ASSERT_TRUE(player.ChangeTrack(NEXT));
+  TEST_ASSERT_EQUAL(3579545 + 2000, bus.clock);
+  TEST_ASSERT_EQUAL(3, bus.clocksSet);
+  TEST_ASSERT_FALSE(bus.clashed);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_header_171_fields);
+  RUN_TEST(test_header_version_and_data_start);
+  RUN_TEST(test_header_opm_stream);
+  RUN_TEST(test_clock_is_set_with_the_card_released);
+  return UNITY_END();
+}
@@ -0,0 +1,49 @@
+#ifndef ARDUINO_H_
+#define ARDUINO_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+//Just enough of the libmaple core for YM2151.cpp on the host. Pins are numbered like the Blue Pill
+//variant and each port is a plain register block, so the fast bus's BSRR stores can be read back
+
+#define OUTPUT 1
+#define HIGH 1
+#define LOW 0
+
+enum
+{
+    PA0, PA1, PA2, PA3, PA4, PA5, PA6, PA7, PA8, PA9, PA10, PA11, PA12, PA13, PA14, PA15,
+    PB0, PB1, PB2, PB3, PB4, PB5, PB6, PB7, PB8, PB9, PB10, PB11, PB12, PB13, PB14, PB15,
+    PC13, PC14, PC15,
+    BOARD_NR_GPIO_PINS
+};
+
+struct gpio_reg_map
+{
+    volatile uint32_t CRL;
+    volatile uint32_t CRH;
+    volatile uint32_t IDR;
+    volatile uint32_t ODR;
+    volatile uint32_t BSRR;
+    volatile uint32_t BRR;
+    volatile uint32_t LCKR;
+};
+
+struct gpio_dev
+{
+    gpio_reg_map *regs;
+};
+
+struct stm32_pin_info
+{
+    gpio_dev *gpio_device;
+    uint8_t gpio_bit;
+};
+
+extern const stm32_pin_info PIN_MAP[BOARD_NR_GPIO_PINS];
+
+inline void disableDebugPorts() {}
+inline void pinMode(uint8_t pin, uint8_t mode) {}
+inline void digitalWrite(uint8_t pin, uint8_t value) {}
+inline void delayMicroseconds(uint32_t us) {}
+#endif
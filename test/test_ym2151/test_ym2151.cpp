@@ -0,0 +1,131 @@
+//YM2151 fast bus and the repeat filter in front of it, against mock GPIO ports. The data pins are spread
+//over three ports the way the board wires them, so each byte has to come out as the right set and reset
+//halves of every port's BSRR
+#include <unity.h>
+#include "Arduino.h"
+#include "CycleCounter.h"
+#define private public //The checks look at the driver's busy period and call WriteDataPins() directly
+#include "YM2151.cpp"
+#undef private
+
+static gpio_reg_map portA, portB, portC;
+static gpio_dev gpioA = {&portA}, gpioB = {&portB}, gpioC = {&portC};
+
+#define PORT_PINS(dev) {&dev, 0}, {&dev, 1}, {&dev, 2}, {&dev, 3}, {&dev, 4}, {&dev, 5}, {&dev, 6}, {&dev, 7}, \
+  {&dev, 8}, {&dev, 9}, {&dev, 10}, {&dev, 11}, {&dev, 12}, {&dev, 13}, {&dev, 14}, {&dev, 15}
+const stm32_pin_info PIN_MAP[BOARD_NR_GPIO_PINS] = {PORT_PINS(gpioA), PORT_PINS(gpioB), {&gpioC, 13}, {&gpioC, 14}, {&gpioC, 15}};
+
+//Same wiring as main.cpp
+static int dataPins[8] = {PB8, PB9, PC13, PC14, PC15, PA0, PA1, PA2};
+
+static YM2151 *makeChip()
+{
+  return new YM2151(dataPins, PB3, PA15, PA12, PA11, 0, PA3);
+}
+
+void setUp() {}
+void tearDown() {}
+
+//Every data pin is in exactly one half of its port's store, and no other pin on the port is touched
+static void test_every_byte_sets_and_resets_the_right_bits()
+{
+  YM2151 *opm = makeChip();
+  gpio_reg_map *ports[3] = {&portA, &portB, &portC};
+  for(uint32_t value = 0; value<256; value++)
+  {
+    for(int p = 0; p<3; p++)
+      ports[p]->BSRR = 0;
+    opm->WriteDataPins(value);
+    uint32_t set[3] = {0, 0, 0};
+    uint32_t reset[3] = {0, 0, 0};
+    for(int i = 0; i<8; i++)
+    {
+      const stm32_pin_info &pin = PIN_MAP[dataPins[i]];
+      int p = pin.gpio_device == &gpioA ? 0 : pin.gpio_device == &gpioB ? 1 : 2;
+      if((value >> i) & 1)
+        set[p] |= 1 << pin.gpio_bit;
+      else
+        reset[p] |= 1 << pin.gpio_bit;
+    }
+    for(int p = 0; p<3; p++)
+      TEST_ASSERT_EQUAL_HEX32(set[p] | (reset[p] << 16), ports[p]->BSRR);
+  }
+  delete opm;
+}
+
+//A register write ends with CS and then WR raised, each on its own port
+static void test_write_ends_with_the_strobes_high()
+{
+  YM2151 *opm = makeChip();
+  opm->SendDataPins(0x20, 0xC7);
+  TEST_ASSERT_EQUAL_HEX32(1 << 3, portB.BSRR); //CS, PB3
+  TEST_ASSERT_EQUAL_HEX32(1 << 12, portA.BSRR); //WR, PA12
+  TEST_ASSERT_EQUAL_HEX32((1 << 13) | (3u << (14+16)), portC.BSRR); //Data bits 2-4 of 0xC7, PC13-PC15
+  delete opm;
+}
+
+//64 master clocks, rounded up to whole cycle counter ticks, and a second write waits all of it out
+static void test_busy_period_follows_the_clock()
+{
+  YM2151 *opm = makeChip();
+  const uint32_t clocks[] = {3579545, 4000000, 3000000, 1000000};
+  for(size_t c = 0; c<sizeof(clocks)/sizeof(clocks[0]); c++)
+  {
+    uint64_t ticks = (uint64_t)YM_BUSY_CLOCKS * CYCLE_TICKS_PER_US * 1000000;
+    opm->SetClock(clocks[c]);
+    TEST_ASSERT_EQUAL_UINT32((ticks + clocks[c] - 1) / clocks[c], opm->_busyCycles);
+    opm->SendDataPins(0x08, c); //Key on is never skipped as a repeat
+    uint32_t first = opm->_lastWrite;
+    TEST_ASSERT_TRUE(opm->Busy());
+    opm->SendDataPins(0x08, c);
+    TEST_ASSERT_GREATER_OR_EQUAL(opm->_busyCycles, opm->_lastWrite - first);
+  }
+  opm->SetClock(0);
+  TEST_ASSERT_EQUAL_UINT32(((uint64_t)YM_BUSY_CLOCKS * CYCLE_TICKS_PER_US * 1000000 + YM_DEFAULT_CLOCK - 1) / YM_DEFAULT_CLOCK, opm->_busyCycles);
+  delete opm;
+}
+
+//A write that repeats a register's value never reaches the port, except to the registers that act on
+//every write. Reset() forgets what the chip holds
+static void test_repeated_values_are_skipped()
+{
+  YM2151 *opm = makeChip();
+  opm->SetClock(100000000); //Short busy period, the test isn't about timing
+  const uint8_t regs[] = {0x20, 0x01, 0x08, 0x14, 0xFF};
+  for(size_t r = 0; r<sizeof(regs); r++)
+  {
+    opm->SendDataPins(regs[r], 0x5A);
+    portA.BSRR = 0;
+    opm->SendDataPins(regs[r], 0x5A);
+    bool always = regs[r] == 0x01 || regs[r] == 0x08 || regs[r] == 0x14;
+    TEST_ASSERT_EQUAL(always, portA.BSRR != 0);
+  }
+  TEST_ASSERT_EQUAL_UINT32(10, opm->TotalWrites());
+  TEST_ASSERT_EQUAL_UINT32(2, opm->ElidedWrites());
+
+  //A new value goes out and becomes the one compared against
+  portA.BSRR = 0;
+  opm->SendDataPins(0x20, 0xA5);
+  TEST_ASSERT_TRUE(portA.BSRR != 0);
+  portA.BSRR = 0;
+  opm->SendDataPins(0x20, 0x5A);
+  TEST_ASSERT_TRUE(portA.BSRR != 0);
+
+  opm->Reset();
+  TEST_ASSERT_EQUAL_UINT32(0, opm->TotalWrites());
+  portA.BSRR = 0;
+  opm->SendDataPins(0x20, 0x5A);
+  TEST_ASSERT_TRUE(portA.BSRR != 0);
+  TEST_ASSERT_EQUAL_UINT32(0, opm->ElidedWrites());
+  delete opm;
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_every_byte_sets_and_resets_the_right_bits);
+  RUN_TEST(test_write_ends_with_the_strobes_high);
+  RUN_TEST(test_busy_period_follows_the_clock);
+  RUN_TEST(test_repeated_values_are_skipped);
+  return UNITY_END();
+}
@@ -0,0 +1,242 @@
+//opmstream - play a .opm (see vgm2opm) live through the board over its serial port
+//
+//Build: g++ -O2 -o opmstream opmstream.cpp
+//Usage: opmstream [-n loops] <serial device> input.opm
+//
+//Speaks the framed protocol in src/SerialStream.h. The command data is cut into frames on command
+//boundaries and only sent as far as the board has granted credit, so its command buffer never
+//overflows and the board's own sample clock sets the pace. The loop is followed [loops] times
+//(default 1), then the stream is closed and the tool waits for the board to finish playing it.
+//The device is put in raw mode at 1Mbaud, which a USB serial port or a pseudo terminal ignores.
+//The host build's -p option serves the player on a pseudo terminal to try this without a board.
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <poll.h>
+#include <vector>
+#include "../src/OPMStream.h"
+#include "../src/SerialStream.h"
+
+#define HANDSHAKE_TIMEOUT_MS 2000
+
+static int port;
+static uint32_t credit; //Payload bytes the board can still take
+
+static uint32_t get32(const std::vector<uint8_t> &d, uint32_t pos)
+{
+  if(pos + 4 > d.size())
+    return 0;
+  return uint32_t(d[pos] + (d[pos+1] << 8) + (d[pos+2] << 16) + (uint32_t(d[pos+3]) << 24));
+}
+
+static void sendFrame(uint8_t type, const uint8_t *payload, uint8_t length)
+{
+  uint8_t frame[STREAM_MAX_PAYLOAD+4] = {STREAM_SYNC, type, length};
+  uint8_t check = type + length;
+  for(uint8_t i = 0; i<length; i++)
+  {
+    frame[3+i] = payload[i];
+    check += payload[i];
+  }
+  frame[3+length] = -check;
+  size_t left = length + 4;
+  const uint8_t *p = frame;
+  while(left > 0)
+  {
+    ssize_t put = write(port, p, left);
+    if(put < 0 && errno != EAGAIN && errno != EINTR)
+    {
+      perror("write");
+      exit(1);
+    }
+    if(put > 0)
+    {
+      p += put;
+      left -= put;
+    }
+  }
+}
+
+//Read one frame from the board, waiting up to timeoutMs. Returns its type, or 0 on a timeout.
+//Anything between frames, such as text the player prints, is skipped
+static uint8_t readFrame(uint8_t *payload, int timeoutMs)
+{
+  static uint8_t frame[STREAM_MAX_PAYLOAD+3];
+  static int got = -1; //-1 while looking for STREAM_SYNC
+  for(;;)
+  {
+    struct pollfd pfd = {port, POLLIN, 0};
+    if(poll(&pfd, 1, timeoutMs) <= 0)
+      return 0;
+    uint8_t c;
+    if(read(port, &c, 1) != 1)
+      continue;
+    if(got < 0)
+    {
+      if(c == STREAM_SYNC)
+        got = 0;
+      continue;
+    }
+    frame[got++] = c;
+    if(got >= 2 && frame[1] > STREAM_MAX_PAYLOAD)
+    {
+      got = -1;
+      continue;
+    }
+    if(got < 2 || got < frame[1] + 3)
+      continue;
+    got = -1;
+    uint8_t check = 0;
+    for(int i = 0; i<frame[1] + 3; i++)
+      check += frame[i];
+    if(check != 0)
+      continue;
+    memcpy(payload, frame+2, frame[1]);
+    return frame[0];
+  }
+}
+
+//Handle one frame from the board. Returns false once the stream is over
+static bool handleBoard(int timeoutMs)
+{
+  uint8_t payload[STREAM_MAX_PAYLOAD];
+  switch(readFrame(payload, timeoutMs))
+  {
+    case STREAM_CREDIT:
+      credit += payload[0] + (payload[1] << 8);
+    return true;
+    case STREAM_DONE:
+    return false;
+    case STREAM_ERROR:
+      if(payload[0] == STREAM_ERR_VERSION)
+        fprintf(stderr, "Board speaks another stream protocol version, update its firmware or this tool\n");
+      else
+        fprintf(stderr, "Board dropped the stream, error %u\n", payload[0]);
+      exit(1);
+    default:
+    return true;
+  }
+}
+
+//Bytes taken by the OPM stream command starting with cmd
+static uint32_t commandLength(uint8_t cmd)
+{
+  if(cmd >= OPM_MIN_DIRECT_REG || cmd == OPM_WAIT8)
+    return 2;
+  if(cmd == OPM_WAIT16 || cmd == OPM_WRITE_LOW)
+    return 3;
+  return 1;
+}
+
+int main(int argc, char **argv)
+{
+  int loops = 1;
+  int opt;
+  while((opt = getopt(argc, argv, "n:")) != -1)
+  {
+    if(opt == 'n')
+      loops = atoi(optarg);
+    else
+      optind = argc;
+  }
+  if(argc - optind != 2)
+  {
+    fprintf(stderr, "Usage: %s [-n loops] <serial device> input.opm\n", argv[0]);
+    return 1;
+  }
+  FILE *in = fopen(argv[optind+1], "rb");
+  if(!in)
+  {
+    perror(argv[optind+1]);
+    return 1;
+  }
+  std::vector<uint8_t> opm;
+  uint8_t chunk[4096];
+  size_t n;
+  while((n = fread(chunk, 1, sizeof(chunk), in)) > 0)
+    opm.insert(opm.end(), chunk, chunk + n);
+  fclose(in);
+  if(get32(opm, 0x00) != OPM_IDENT)
+  {
+    fprintf(stderr, "%s: not an OPM stream, convert it with vgm2opm first\n", argv[optind+1]);
+    return 1;
+  }
+  uint32_t clock = get32(opm, 0x0C);
+  uint32_t loopStart = get32(opm, 0x14);
+  uint32_t dataStart = get32(opm, 0x1C);
+
+  port = open(argv[optind], O_RDWR | O_NOCTTY);
+  if(port < 0)
+  {
+    perror(argv[optind]);
+    return 1;
+  }
+  struct termios raw;
+  if(tcgetattr(port, &raw) == 0)
+  {
+    cfmakeraw(&raw);
+    cfsetspeed(&raw, B1000000);
+    tcsetattr(port, TCSANOW, &raw);
+  }
+
+  uint8_t open[STREAM_OPEN_SIZE] = {uint8_t(STREAM_MAGIC), uint8_t(STREAM_MAGIC >> 8), uint8_t(STREAM_MAGIC >> 16), uint8_t(STREAM_MAGIC >> 24),
+    STREAM_VERSION, uint8_t(clock), uint8_t(clock >> 8), uint8_t(clock >> 16), uint8_t(clock >> 24)};
+  sendFrame(STREAM_OPEN, open, STREAM_OPEN_SIZE);
+  //The board answers with its first credit. Give up if it doesn't, it isn't listening for streams
+  for(int waited = 0; credit == 0; waited += 100)
+  {
+    if(waited >= HANDSHAKE_TIMEOUT_MS)
+    {
+      fprintf(stderr, "%s: no answer to the stream handshake\n", argv[optind]);
+      return 1;
+    }
+    handleBoard(100);
+  }
+  uint32_t pos = dataStart;
+  uint32_t sent = 0;
+  std::vector<uint8_t> frame;
+  while(loops > 0 || !frame.empty())
+  {
+    //Gather whole commands up to a full frame
+    while(loops > 0 && pos < opm.size())
+    {
+      uint8_t cmd = opm[pos];
+      if(cmd == OPM_END)
+      {
+        if(--loops > 0)
+          pos = loopStart ? loopStart : dataStart;
+        break;
+      }
+      uint32_t len = commandLength(cmd);
+      if(pos + len > opm.size()) //Truncated file, stop at the last whole command
+      {
+        loops = 0;
+        break;
+      }
+      if(frame.size() + len > STREAM_MAX_PAYLOAD)
+        break;
+      frame.insert(frame.end(), opm.begin() + pos, opm.begin() + pos + len);
+      pos += len;
+    }
+    if(pos >= opm.size())
+      loops = 0;
+    if(frame.empty())
+      continue;
+    while(credit < frame.size())
+      if(!handleBoard(-1))
+        return 0;
+    sendFrame(STREAM_DATA, frame.data(), frame.size());
+    credit -= frame.size();
+    sent += frame.size();
+    frame.clear();
+  }
+  sendFrame(STREAM_CLOSE, NULL, 0);
+  while(handleBoard(-1)){}
+  fprintf(stderr, "Streamed %lu bytes\n", (unsigned long)sent);
+  return 0;
+}
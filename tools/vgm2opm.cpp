@@ -0,0 +1,215 @@
+//vgm2opm - compile a .vgm into the compact YM2151-only stream described in src/OPMStream.h
+//
+//Build: g++ -O2 -o vgm2opm vgm2opm.cpp
+//Usage: vgm2opm input.vgm output.opm
+//
+//Only first-chip YM2151 writes (0x54) survive. Every other command is skipped by its exact
+//length, data blocks are dropped, consecutive waits are merged and the loop point is resolved
+//to an offset in the output stream. The GD3 tag is copied verbatim after the command data.
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "../src/OPMStream.h"
+#include "../src/VGMOpcodes.h"
+
+#define VGM_IDENT 0x206D6756
+
+static uint32_t get32(const std::vector<uint8_t> &d, uint32_t pos)
+{
+  if(pos + 4 > d.size())
+    return 0;
+  return uint32_t(d[pos] + (d[pos+1] << 8) + (d[pos+2] << 16) + (uint32_t(d[pos+3]) << 24));
+}
+
+static void put32(std::vector<uint8_t> &d, uint32_t pos, uint32_t v)
+{
+  d[pos] = v; d[pos+1] = v >> 8; d[pos+2] = v >> 16; d[pos+3] = v >> 24;
+}
+
+//Operand byte count for a VGM 1.71 command, or -1 if undefined. 0x67 and 0x68 are handled separately.
+static int operandLength(uint8_t cmd)
+{
+  uint8_t op = vgmOpcodes[cmd];
+  return VGM_OP_KIND(op) == VGM_UNKNOWN ? -1 : VGM_OP_LENGTH(op);
+}
+
+//Emit a merged wait, split into 16 bit chunks
+static void flushWait(std::vector<uint8_t> &out, uint32_t &wait)
+{
+  while(wait > 0)
+  {
+    uint32_t w = wait > 0xFFFF ? 0xFFFF : wait;
+    if(w <= 256)
+    {
+      out.push_back(OPM_WAIT8);
+      out.push_back(w - 1);
+    }
+    else
+    {
+      out.push_back(OPM_WAIT16);
+      out.push_back(w & 0xFF);
+      out.push_back(w >> 8);
+    }
+    wait -= w;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if(argc != 3)
+  {
+    fprintf(stderr, "Usage: %s input.vgm output.opm\n", argv[0]);
+    return 1;
+  }
+  FILE *in = fopen(argv[1], "rb");
+  if(!in)
+  {
+    perror(argv[1]);
+    return 1;
+  }
+  std::vector<uint8_t> vgm;
+  uint8_t chunk[4096];
+  size_t n;
+  while((n = fread(chunk, 1, sizeof(chunk), in)) > 0)
+    vgm.insert(vgm.end(), chunk, chunk + n);
+  fclose(in);
+
+  if(get32(vgm, 0x00) != VGM_IDENT)
+  {
+    fprintf(stderr, "%s: not an uncompressed VGM file\n", argv[1]);
+    return 1;
+  }
+  uint32_t version = get32(vgm, 0x08);
+  uint32_t dataStart = 0x40;
+  if(version >= 0x150 && get32(vgm, 0x34) != 0)
+    dataStart = get32(vgm, 0x34) + 0x34;
+  uint32_t gd3Start = get32(vgm, 0x14) ? get32(vgm, 0x14) + 0x14 : 0;
+  uint32_t loopStart = get32(vgm, 0x1C) ? get32(vgm, 0x1C) + 0x1C : 0;
+  //Before 1.10 the YM2413 clock field doubled as the YM2151 clock. Top bits are the dual chip flags
+  uint32_t clock = (version >= 0x110 ? get32(vgm, 0x30) : get32(vgm, 0x10)) & 0x3FFFFFFF;
+  if(clock == 0)
+  {
+    fprintf(stderr, "%s: no YM2151 in this VGM\n", argv[1]);
+    return 1;
+  }
+
+  std::vector<uint8_t> out(OPM_HEADER_SIZE, 0);
+  uint32_t loopOut = 0;
+  uint32_t wait = 0;
+  uint32_t writes = 0, skipped = 0, dataBlockBytes = 0;
+  uint32_t pos = dataStart;
+  bool ended = false;
+  while(pos < vgm.size() && !ended)
+  {
+    if(loopStart != 0 && pos == loopStart)
+    {
+      flushWait(out, wait);
+      loopOut = out.size();
+    }
+    uint8_t cmd = vgm[pos++];
+    switch(cmd)
+    {
+      case 0x54:
+      {
+        if(pos + 2 > vgm.size())
+        {
+          ended = true;
+          break;
+        }
+        uint8_t a = vgm[pos];
+        uint8_t d = vgm[pos+1];
+        flushWait(out, wait);
+        if(a < OPM_MIN_DIRECT_REG)
+          out.push_back(OPM_WRITE_LOW);
+        out.push_back(a);
+        out.push_back(d);
+        writes++;
+        pos += 2;
+        break;
+      }
+      case 0x61:
+        if(pos + 2 > vgm.size())
+        {
+          ended = true;
+          break;
+        }
+        wait += vgm[pos] + (vgm[pos+1] << 8);
+        pos += 2;
+        break;
+      case 0x62:
+        wait += 735;
+        break;
+      case 0x63:
+        wait += 882;
+        break;
+      case 0x66:
+        ended = true;
+        break;
+      case 0x67: //0x67 0x66 tt ss ss ss ss <data>
+      {
+        uint32_t size = get32(vgm, pos + 2) & 0x7FFFFFFF;
+        pos += 6 + size;
+        dataBlockBytes += size;
+        break;
+      }
+      case 0x68: //0x68 0x66 cc oo oo oo dd dd dd ss ss ss
+        pos += 11;
+        skipped++;
+        break;
+      default:
+      {
+        int len = operandLength(cmd);
+        if(len < 0)
+        {
+          fprintf(stderr, "%s: unknown command 0x%02X at 0x%X\n", argv[1], cmd, pos - 1);
+          return 1;
+        }
+        if(cmd >= 0x70 && cmd <= 0x7F)
+          wait += (cmd & 0x0F) + 1;
+        else if(cmd >= 0x80 && cmd <= 0x8F) //YM2612 DAC write with a built in wait
+        {
+          wait += cmd & 0x0F;
+          skipped++;
+        }
+        else
+          skipped++;
+        pos += len;
+        break;
+      }
+    }
+  }
+  flushWait(out, wait);
+  out.push_back(OPM_END);
+
+  uint32_t gd3Out = 0;
+  if(gd3Start != 0 && gd3Start + 12 <= vgm.size())
+  {
+    uint32_t gd3End = gd3Start + 12 + get32(vgm, gd3Start + 8);
+    if(gd3End > vgm.size())
+      gd3End = vgm.size();
+    gd3Out = out.size();
+    out.insert(out.end(), vgm.begin() + gd3Start, vgm.begin() + gd3End);
+  }
+
+  put32(out, 0x00, OPM_IDENT);
+  put32(out, 0x04, out.size());
+  put32(out, 0x08, OPM_VERSION);
+  put32(out, 0x0C, clock);
+  put32(out, 0x10, get32(vgm, 0x18));
+  put32(out, 0x14, loopOut);
+  put32(out, 0x18, loopOut ? get32(vgm, 0x20) : 0);
+  put32(out, 0x1C, OPM_HEADER_SIZE);
+  put32(out, 0x20, gd3Out);
+
+  FILE *o = fopen(argv[2], "wb");
+  if(!o || fwrite(&out[0], 1, out.size(), o) != out.size())
+  {
+    perror(argv[2]);
+    return 1;
+  }
+  fclose(o);
+  printf("%s: %u -> %u bytes, %u YM2151 writes, %u foreign commands and %u data block bytes stripped\n",
+    argv[1], (unsigned)vgm.size(), (unsigned)out.size(), writes, skipped, dataBlockBytes);
+  return 0;
+}